@@ -0,0 +1,61 @@
+#include "test_helpers.h"
+#include <chrono>
+
+using std::cout;
+using std::endl;
+using std::make_shared;
+
+int main()
+{
+    const int OBSERVERS = 1000;
+    const int EVENTS = 200000;
+
+    auto table = SpeciesTable::current();
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> coord_x(0, MAP_WIDTH - 1);
+    std::uniform_int_distribution<int> coord_y(0, MAP_HEIGHT - 1);
+    std::uniform_int_distribution<int> species_dist(-1, table->count() - 1);
+    std::uniform_int_distribution<int> size_dist(5, 30);
+    std::uniform_int_distribution<int> sample_dist(1, 10);
+
+    // Подписчики с разными областями, видами и частотой выборки
+    KillDispatcher filtered;
+    KillDispatcher broadcast;
+    for (int i = 0; i < OBSERVERS; ++i)
+    {
+        KillFilter f;
+        f.min_x = coord_x(gen);
+        f.min_y = coord_y(gen);
+        f.max_x = f.min_x + size_dist(gen);
+        f.max_y = f.min_y + size_dist(gen);
+        f.killer_species = species_dist(gen);
+        f.victim_species = species_dist(gen);
+        f.sample_every = sample_dist(gen);
+        filtered.subscribe(make_shared<CountingObserver>(), f);
+        broadcast.subscribe(make_shared<CountingObserver>());
+    }
+
+    // Пары NPC для событий, сгенерированные заранее
+    vector<shared_ptr<NPC>> killers;
+    vector<shared_ptr<NPC>> victims;
+    std::uniform_int_distribution<int> any_species(0, table->count() - 1);
+    for (int i = 0; i < 1024; ++i)
+    {
+        killers.push_back(make_shared<NPC>(any_species(gen), "K", coord_x(gen), coord_y(gen)));
+        victims.push_back(make_shared<NPC>(any_species(gen), "V", coord_x(gen), coord_y(gen)));
+    }
+
+    auto measure = [&](KillDispatcher& d)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < EVENTS; ++i)
+            d.dispatch(*killers[i % 1024], *victims[i % 1024]);
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(end - start).count() / EVENTS;
+    };
+
+    cout << "Наблюдателей: " << OBSERVERS << ", событий: " << EVENTS << endl;
+    cout << "С фильтрами: " << measure(filtered) << " нс/событие" << endl;
+    cout << "Рассылка всем: " << measure(broadcast) << " нс/событие" << endl;
+    return 0;
+}
@@ -7,6 +7,9 @@
 #include <random>
 #include <iomanip>
 #include <cctype>
+#include <sstream>
+#include <stdexcept>
+#include <limits>
 
 using std::cout;
 using std::endl;
@@ -45,9 +48,425 @@ void FileObserver::on_kill(const string& killer, const string& victim)
     }
 }
 
+//================ Species ==================
+// Встроенные виды генерируются CMake из species.txt
+#include "species_default.h"
+
+// Текущая таблица и мьютекс для ее замены
+static shared_ptr<const SpeciesTable> current_species;
+static std::mutex species_mutex;
+
+const char* SpeciesTable::default_config()
+{
+    return DEFAULT_SPECIES_CONFIG;
+}
+
+shared_ptr<const SpeciesTable> SpeciesTable::current()
+{
+    std::lock_guard<std::mutex> lock(species_mutex);
+    if (!current_species)
+    {
+        std::istringstream in(DEFAULT_SPECIES_CONFIG);
+        current_species = parse(in);
+    }
+    return current_species;
+}
+
+void SpeciesTable::install(shared_ptr<const SpeciesTable> table)
+{
+    std::lock_guard<std::mutex> lock(species_mutex);
+    // Индексы видов уже розданы NPC и движкам, их таблица должна дожить до конца
+    if (current_species && current_species.use_count() > 1)
+        throw std::runtime_error("Таблица видов используется, заменить ее нельзя");
+    current_species = std::move(table);
+}
+
+bool SpeciesTable::load(const string& filename)
+{
+    std::ifstream in(filename);
+    if (!in) return false;
+    install(parse(in));
+    return true;
+}
+
+shared_ptr<const SpeciesTable> SpeciesTable::parse(std::istream& in)
+{
+    vector<string> new_names;
+    vector<int> new_moves;
+    vector<int> new_kills;
+    vector<std::pair<string, string>> pairs;
+
+    string line;
+    while (std::getline(in, line))
+    {
+        std::istringstream row(line);
+        string keyword;
+        if (!(row >> keyword) || keyword[0] == '#') continue;
+
+        if (keyword == "species")
+        {
+            string name;
+            int move, kill;
+            if (!(row >> name >> move >> kill) || move < 0 || kill < 0)
+                throw std::runtime_error("Некорректное описание вида: " + line);
+            if (std::find(new_names.begin(), new_names.end(), name) != new_names.end())
+                throw std::runtime_error("Вид объявлен повторно: " + name);
+            new_names.push_back(name);
+            new_moves.push_back(move);
+            new_kills.push_back(kill);
+        }
+        else if (keyword == "eats")
+        {
+            string attacker, victim;
+            if (!(row >> attacker >> victim))
+                throw std::runtime_error("Некорректное правило боя: " + line);
+            pairs.emplace_back(attacker, victim);
+        }
+        else
+        {
+            throw std::runtime_error("Неизвестная директива: " + keyword);
+        }
+    }
+
+    if (new_names.empty())
+        throw std::runtime_error("Не описано ни одного вида NPC");
+
+    // Компилируем правила в плоскую матрицу
+    int n = static_cast<int>(new_names.size());
+    auto index_of = [&](const string& name)
+    {
+        auto it = std::find(new_names.begin(), new_names.end(), name);
+        if (it == new_names.end())
+            throw std::runtime_error("Неизвестный вид в правиле боя: " + name);
+        return static_cast<int>(it - new_names.begin());
+    };
+
+    vector<unsigned char> new_eats(n * n, 0);
+    vector<unsigned char> new_fights(n, 0);
+    for (auto& [attacker, victim] : pairs)
+    {
+        int a = index_of(attacker);
+        int v = index_of(victim);
+        new_eats[a * n + v] = 1;
+        new_fights[a] = new_fights[v] = 1;
+    }
+
+    shared_ptr<SpeciesTable> table(new SpeciesTable());
+    table->names = std::move(new_names);
+    table->moves = std::move(new_moves);
+    table->kills = std::move(new_kills);
+    table->eats = std::move(new_eats);
+    table->fights = std::move(new_fights);
+    table->max_kill = *std::max_element(table->kills.begin(), table->kills.end());
+    return table;
+}
+
+int SpeciesTable::find(const string& name) const
+{
+    auto it = std::find(names.begin(), names.end(), name);
+    return it == names.end() ? -1 : static_cast<int>(it - names.begin());
+}
+
+string SpeciesTable::list_names() const
+{
+    string result;
+    for (auto& n : names)
+    {
+        if (!result.empty()) result += "/";
+        result += n;
+    }
+    return result;
+}
+
+//================ Sweep ====================
+double closest_approach(const Sweep& a, const Sweep& b)
+{
+    // Движение B относительно A: R(t) = r0 + t * dr, t в [0, 1]
+    double r0x = b.x0 - a.x0;
+    double r0y = b.y0 - a.y0;
+    double drx = (b.x1 - b.x0) - (a.x1 - a.x0);
+    double dry = (b.y1 - b.y0) - (a.y1 - a.y0);
+
+    double dr2 = drx * drx + dry * dry;
+    double t = 0.0;
+    if (dr2 > 0.0)
+        t = std::clamp(-(r0x * drx + r0y * dry) / dr2, 0.0, 1.0);
+
+    double cx = r0x + t * drx;
+    double cy = r0y + t * dry;
+    return std::sqrt(cx * cx + cy * cy);
+}
+
+// Ход step пути из n отрезков, дополненного в начале стоянием до steps ходов
+static Sweep path_step(const Sweep* path, size_t n, size_t steps, size_t step)
+{
+    size_t idle = steps - n;
+    if (step < idle)
+        return {path[0].x0, path[0].y0, path[0].x0, path[0].y0};
+    return path[step - idle];
+}
+
+double closest_approach(const Sweep* a, size_t na, const Sweep* b, size_t nb)
+{
+    // Ходы одного тика перемещения идут одновременно, поэтому сравниваем
+    // отрезки попарно: разворот на пути не спрямляется в один отрезок
+    size_t steps = std::max(na, nb);
+    double best = std::numeric_limits<double>::infinity();
+    for (size_t step = 0; step < steps; ++step)
+        best = std::min(best, closest_approach(path_step(a, na, steps, step),
+                                               path_step(b, nb, steps, step)));
+    return best;
+}
+
+void path_bounds(const Sweep* path, size_t n, int& min_x, int& min_y, int& max_x, int& max_y)
+{
+    min_x = max_x = path[0].x0;
+    min_y = max_y = path[0].y0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        min_x = std::min({min_x, path[i].x0, path[i].x1});
+        min_y = std::min({min_y, path[i].y0, path[i].y1});
+        max_x = std::max({max_x, path[i].x0, path[i].x1});
+        max_y = std::max({max_y, path[i].y0, path[i].y1});
+    }
+}
+
+//================ Kill dispatch ============
+KillDispatcher::KillDispatcher()
+    : table(SpeciesTable::current()),
+      species_count(table->count()),
+      group_index((species_count + 1) * (species_count + 1), -1) {}
+
+void KillDispatcher::subscribe(shared_ptr<Observer> observer, const KillFilter& filter)
+{
+    for (int species : {filter.killer_species, filter.victim_species})
+        if (species < -1 || species >= species_count)
+            throw std::runtime_error("Неизвестный вид в фильтре подписки");
+
+    auto sub = std::make_unique<Subscription>();
+    sub->observer = std::move(observer);
+    sub->filter = filter;
+    sub->filter.sample_every = std::max(1, filter.sample_every);
+
+    std::unique_lock<std::shared_mutex> lock(mtx);
+
+    Route route{filter.min_x, filter.min_y, filter.max_x, filter.max_y, sub.get()};
+
+    // Фильтры по видам и району проверяются один раз здесь, а не на каждом событии
+    int& index = group_index[group_key(filter.killer_species, filter.victim_species)];
+    if (index < 0)
+    {
+        index = static_cast<int>(groups.size());
+        groups.emplace_back();
+    }
+    Group& group = groups[index];
+
+    int c0 = regions.col(filter.min_x), c1 = regions.col(filter.max_x);
+    int r0 = regions.row(filter.min_y), r1 = regions.row(filter.max_y);
+    if (c0 == 0 && r0 == 0 && c1 == regions.cols - 1 && r1 == regions.rows - 1)
+    {
+        group.everywhere.push_back(route);
+    }
+    else
+    {
+        if (group.by_region.empty())
+            group.by_region.resize(regions.count());
+        for (int r = r0; r <= r1; ++r)
+            for (int c = c0; c <= c1; ++c)
+                group.by_region[r * regions.cols + c].push_back(route);
+    }
+    subscriptions.push_back(std::move(sub));
+}
+
+void KillDispatcher::dispatch(NPC& killer, NPC& victim)
+{
+    std::shared_lock<std::shared_mutex> lock(mtx);
+
+    auto [x, y] = victim.get_position();
+    int region = regions.index(x, y);
+
+    // Не больше двух списков из каждой из четырех групп
+    const int ANY = -1;
+    const int keys[4] = {group_key(killer.species(), victim.species()),
+                         group_key(killer.species(), ANY),
+                         group_key(ANY, victim.species()),
+                         group_key(ANY, ANY)};
+    const vector<Route>* lists[8];
+    int list_count = 0;
+    for (int key : keys)
+    {
+        if (group_index[key] < 0) continue;
+        const Group& group = groups[group_index[key]];
+        if (!group.everywhere.empty())
+            lists[list_count++] = &group.everywhere;
+        if (!group.by_region.empty() && !group.by_region[region].empty())
+            lists[list_count++] = &group.by_region[region];
+    }
+
+    string killer_name;
+    string victim_name;
+
+    for (int i = 0; i < list_count; ++i)
+    {
+        for (const Route& route : *lists[i])
+        {
+            if (x < route.min_x || x > route.max_x || y < route.min_y || y > route.max_y) continue;
+
+            Subscription* sub = route.sub;
+            int every = sub->filter.sample_every;
+            if (every > 1 &&
+                sub->seen.fetch_add(1, std::memory_order_relaxed) % every != 0) continue;
+
+            // Имена копируются только если событие кому-то доставляется
+            if (killer_name.empty())
+            {
+                killer_name = killer.get_name();
+                victim_name = victim.get_name();
+            }
+            sub->observer->on_kill(killer_name, victim_name);
+        }
+    }
+}
+
+size_t KillDispatcher::size() const
+{
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    return subscriptions.size();
+}
+
+//================ Statistics ===============
+WorldStats::WorldStats(const RegionGrid& grid)
+    : table(SpeciesTable::current()),
+      species_count(table->count()),
+      regions(grid),
+      alive_by_species(species_count),
+      kills_by_pair(species_count * species_count),
+      density_by_region(regions.count()),
+      kills_at_last_tick(species_count * species_count, 0) {}
+
+void WorldStats::reset()
+{
+    total = 0;
+    for (auto& c : alive_by_species) c = 0;
+    for (auto& c : kills_by_pair) c = 0;
+    for (auto& c : density_by_region) c = 0;
+
+    std::lock_guard<std::mutex> lock(series_mutex);
+    samples.clear();
+    std::fill(kills_at_last_tick.begin(), kills_at_last_tick.end(), 0);
+}
+
+void WorldStats::on_spawn(int species, int x, int y)
+{
+    total.fetch_add(1, std::memory_order_relaxed);
+    alive_by_species[species].fetch_add(1, std::memory_order_relaxed);
+    density_by_region[regions.index(x, y)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void WorldStats::on_move(int old_x, int old_y, int new_x, int new_y)
+{
+    int from = regions.index(old_x, old_y);
+    int to = regions.index(new_x, new_y);
+    if (from == to) return;
+
+    density_by_region[from].fetch_sub(1, std::memory_order_relaxed);
+    density_by_region[to].fetch_add(1, std::memory_order_relaxed);
+}
+
+void WorldStats::on_kill(int killer, int victim, int x, int y)
+{
+    total.fetch_sub(1, std::memory_order_relaxed);
+    alive_by_species[victim].fetch_sub(1, std::memory_order_relaxed);
+    density_by_region[regions.index(x, y)].fetch_sub(1, std::memory_order_relaxed);
+    kills_by_pair[killer * species_count + victim].fetch_add(1, std::memory_order_relaxed);
+}
+
+void WorldStats::end_tick()
+{
+    StatsSample sample;
+    sample.alive.reserve(species_count);
+    for (auto& c : alive_by_species)
+        sample.alive.push_back(c.load(std::memory_order_relaxed));
+
+    std::lock_guard<std::mutex> lock(series_mutex);
+    sample.tick = static_cast<long>(samples.size()) + 1;
+    sample.kills.reserve(kills_by_pair.size());
+    for (size_t i = 0; i < kills_by_pair.size(); ++i)
+    {
+        long now = kills_by_pair[i].load(std::memory_order_relaxed);
+        sample.kills.push_back(now - kills_at_last_tick[i]);
+        kills_at_last_tick[i] = now;
+    }
+    samples.push_back(std::move(sample));
+}
+
+long WorldStats::alive_total() const
+{
+    return total.load(std::memory_order_relaxed);
+}
+
+long WorldStats::alive(int species) const
+{
+    return alive_by_species[species].load(std::memory_order_relaxed);
+}
+
+int WorldStats::species_alive() const
+{
+    int result = 0;
+    for (auto& c : alive_by_species)
+        if (c.load(std::memory_order_relaxed) > 0) ++result;
+    return result;
+}
+
+long WorldStats::kills(int killer, int victim) const
+{
+    return kills_by_pair[killer * species_count + victim].load(std::memory_order_relaxed);
+}
+
+long WorldStats::density(int region_col, int region_row) const
+{
+    return density_by_region[region_row * regions.cols + region_col].load(std::memory_order_relaxed);
+}
+
+vector<StatsSample> WorldStats::series() const
+{
+    std::lock_guard<std::mutex> lock(series_mutex);
+    return samples;
+}
+
+void WorldStats::export_csv(const string& filename) const
+{
+    std::ofstream out(filename);
+
+    out << "tick";
+    for (int s = 0; s < species_count; ++s)
+        out << ",alive_" << table->name(s);
+    for (int k = 0; k < species_count; ++k)
+        for (int v = 0; v < species_count; ++v)
+            if (table->can_kill(k, v))
+                out << ",kills_" << table->name(k) << "_" << table->name(v);
+    out << endl;
+
+    for (auto& sample : series())
+    {
+        out << sample.tick;
+        for (long a : sample.alive)
+            out << "," << a;
+        for (int k = 0; k < species_count; ++k)
+            for (int v = 0; v < species_count; ++v)
+                if (table->can_kill(k, v))
+                    out << "," << sample.kills[k * species_count + v];
+        out << endl;
+    }
+}
+
 //================ NPC ======================
-NPC::NPC(const string& n, int px, int py)
-    : name(n), x(px), y(py), alive(true) {}
+NPC::NPC(int species, const string& n, int px, int py)
+    : table(SpeciesTable::current()), species_id(species), name(n), x(px), y(py), alive(true)
+{
+    if (species < 0 || species >= table->count())
+        throw std::runtime_error("Неизвестный вид NPC");
+}
 
 double NPC::distance_to(int other_x, int other_y) const
 {
@@ -80,6 +499,8 @@ void NPC::move(int dx, int dy)
     
     int new_x = x + dx;
     int new_y = y + dy;
+    int old_x = x;
+    int old_y = y;
     
     // Проверка границ карты
     if (new_x >= 0 && new_x < MAP_WIDTH && new_y >= 0 && new_y < MAP_HEIGHT)
@@ -87,19 +508,47 @@ void NPC::move(int dx, int dy)
         x = new_x;
         y = new_y;
     }
+    
+    // Отрезок пишется и для отклоненного хода, чтобы пути всех NPC
+    // оставались выровнены по ходам
+    path.push_back({old_x, old_y, x, y});
 }
 
 void NPC::move_random(std::mt19937& gen)
 {
     if (!is_alive()) return;
     
-    std::uniform_int_distribution<int> dir_dist(-1, 1);
+    int step = get_move_distance();
+    std::uniform_int_distribution<int> dir_dist(-step, step);
     int dx = dir_dist(gen);
     int dy = dir_dist(gen);
     
+    // Обрезаем шаг по границам карты, чтобы дальние прыжки не отбрасывались
+    auto [cur_x, cur_y] = get_position();
+    dx = std::clamp(cur_x + dx, 0, MAP_WIDTH - 1) - cur_x;
+    dy = std::clamp(cur_y + dy, 0, MAP_HEIGHT - 1) - cur_y;
+    
     move(dx, dy);
 }
 
+size_t NPC::get_path(vector<Sweep>& out) const
+{
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    if (path.empty())
+    {
+        out.push_back({x, y, x, y});
+        return 1;
+    }
+    out.insert(out.end(), path.begin(), path.end());
+    return path.size();
+}
+
+void NPC::reset_path()
+{
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    path.clear();
+}
+
 string NPC::get_name() const 
 { 
     std::shared_lock<std::shared_mutex> lock(mtx);
@@ -133,26 +582,10 @@ char NPC::get_symbol() const
     return std::toupper(static_cast<unsigned char>(type_char));
 }
 
-//================ Orc ======================
-Orc::Orc(const string& n, int x, int y) : NPC(n, x, y) {}
-string Orc::type() const { return "Orc"; }
-int Orc::get_move_distance() const { return 20; }
-int Orc::get_kill_distance() const { return 10; }
-void Orc::accept(Visitor& v) { v.visit(*this); }
-
-//================ Bear =====================
-Bear::Bear(const string& n, int x, int y) : NPC(n, x, y) {}
-string Bear::type() const { return "Bear"; }
-int Bear::get_move_distance() const { return 5; }
-int Bear::get_kill_distance() const { return 10; }
-void Bear::accept(Visitor& v) { v.visit(*this); }
-
-//================ Squirrel =================
-Squirrel::Squirrel(const string& n, int x, int y) : NPC(n, x, y) {}
-string Squirrel::type() const { return "Squirrel"; }
-int Squirrel::get_move_distance() const { return 5; }
-int Squirrel::get_kill_distance() const { return 5; }
-void Squirrel::accept(Visitor& v) { v.visit(*this); }
+string NPC::type() const { return table->name(species_id); }
+int NPC::get_move_distance() const { return table->move_distance(species_id); }
+int NPC::get_kill_distance() const { return table->kill_distance(species_id); }
+void NPC::accept(Visitor& v) { v.visit(*this); }
 
 //================ Factory ==================
 shared_ptr<NPC> NPCFactory::create(const string& type,
@@ -163,11 +596,11 @@ shared_ptr<NPC> NPCFactory::create(const string& type,
     if (x < 0 || x >= MAP_WIDTH || y < 0 || y >= MAP_HEIGHT)
         throw std::runtime_error("Координаты вне диапазона карты");
 
-    if (type == "Orc") return make_shared<Orc>(name, x, y);
-    if (type == "Bear") return make_shared<Bear>(name, x, y);
-    if (type == "Squirrel") return make_shared<Squirrel>(name, x, y);
+    int species = SpeciesTable::current()->find(type);
+    if (species < 0)
+        throw std::runtime_error("Неизвестный тип NPC");
 
-    throw std::runtime_error("Неизвестный тип NPC");
+    return make_shared<NPC>(species, name, x, y);
 }
 
 shared_ptr<NPC> NPCFactory::create_random(const string& type_prefix, std::mt19937& gen)
@@ -176,10 +609,10 @@ shared_ptr<NPC> NPCFactory::create_random(const string& type_prefix, std::mt1993
     std::uniform_int_distribution<int> coord_x(0, MAP_WIDTH - 1);
     std::uniform_int_distribution<int> coord_y(0, MAP_HEIGHT - 1);
     
-    vector<string> types = {"Orc", "Bear", "Squirrel"};
-    std::uniform_int_distribution<int> type_dist(0, types.size() - 1);
+    auto table = SpeciesTable::current();
+    std::uniform_int_distribution<int> type_dist(0, table->count() - 1);
     
-    string type = types[type_dist(gen)];
+    string type = table->name(type_dist(gen));
     string name = type_prefix + std::to_string(++counter);
     int x = coord_x(gen);
     int y = coord_y(gen);
@@ -187,11 +620,60 @@ shared_ptr<NPC> NPCFactory::create_random(const string& type_prefix, std::mt1993
     return create(type, name, x, y);
 }
 
+//================ Spatial index ============
+SpatialGrid::SpatialGrid(int size, int width, int height)
+    : cell_size(size),
+      cols((width + size - 1) / size),
+      rows((height + size - 1) / size),
+      cells(cols * rows) {}
+
+int SpatialGrid::cell_col(int x) const
+{
+    return std::clamp((x - origin_x) / cell_size, 0, cols - 1);
+}
+
+int SpatialGrid::cell_row(int y) const
+{
+    return std::clamp((y - origin_y) / cell_size, 0, rows - 1);
+}
+
+void SpatialGrid::clear()
+{
+    for (auto& cell : cells)
+        cell.clear();
+}
+
+void SpatialGrid::insert(int id, int min_x, int min_y, int max_x, int max_y)
+{
+    if (id >= static_cast<int>(stamps.size()))
+        stamps.resize(id + 1, 0);
+
+    for (int r = cell_row(min_y); r <= cell_row(max_y); ++r)
+        for (int c = cell_col(min_x); c <= cell_col(max_x); ++c)
+            cells[r * cols + c].push_back(id);
+}
+
+void SpatialGrid::query(int min_x, int min_y, int max_x, int max_y, vector<int>& out)
+{
+    out.clear();
+    ++current_stamp;
+
+    for (int r = cell_row(min_y); r <= cell_row(max_y); ++r)
+        for (int c = cell_col(min_x); c <= cell_col(max_x); ++c)
+            for (int id : cells[r * cols + c])
+            {
+                if (stamps[id] == current_stamp) continue;
+                stamps[id] = current_stamp;
+                out.push_back(id);
+            }
+}
+
 //================ Battle ===================
 BattleVisitor::BattleVisitor(NPC& a,
-                             vector<shared_ptr<Observer>>& o,
-                             std::mt19937& g)
-    : attacker(a), observers(o), gen(g) {}
+                             KillDispatcher& d,
+                             std::mt19937& g,
+                             WorldStats* st)
+    : attacker(a), dispatcher(d), gen(g), stats(st) {}
 
 bool BattleVisitor::roll_dice_battle()
 {
@@ -201,51 +683,454 @@ bool BattleVisitor::roll_dice_battle()
     return attack_power > defense_power;
 }
 
-void BattleVisitor::notify(const string& victim)
-{
-    for (auto& obs : observers)
-        obs->on_kill(attacker.get_name(), victim);
-}
-
-void BattleVisitor::visit(Orc& npc)
+void BattleVisitor::visit(NPC& npc)
 {
     if (!npc.is_alive()) return;
     
-    if (attacker.type() == "Orc" || attacker.type() == "Bear")
+    // Правила боя берутся из скомпилированной матрицы видов
+    if (attacker.species_table().can_kill(attacker.species(), npc.species()))
     {
         if (roll_dice_battle())
         {
             npc.kill(); 
-            notify(npc.get_name());
+            if (stats)
+            {
+                auto [x, y] = npc.get_position();
+                stats->on_kill(attacker.species(), npc.species(), x, y);
+            }
+            dispatcher.dispatch(attacker, npc);
         }
     }
 }
 
-void BattleVisitor::visit(Bear& npc)
+//================ Active regions ===========
+ActiveRegions::ActiveRegions()
+    : table(SpeciesTable::current()),
+      species_count(table->count()),
+      members(regions.count()),
+      counts(regions.count() * species_count, 0),
+      live_pairs(regions.count(), 0),
+      partners(species_count)
 {
-    if (!npc.is_alive()) return;
+    for (int a = 0; a < species_count; ++a)
+        for (int b = 0; b < species_count; ++b)
+            if (table->can_kill(a, b) || table->can_kill(b, a))
+                partners[a].push_back(b);
+}
+
+void ActiveRegions::clear()
+{
+    entries.clear();
+    for (auto& m : members) m.clear();
+    std::fill(counts.begin(), counts.end(), 0);
+    std::fill(live_pairs.begin(), live_pairs.end(), 0);
+    next_order = 0;
+}
+
+void ActiveRegions::bounds(const NPC& npc, int& c0, int& r0, int& c1, int& r1)
+{
+    // Половины дальностей двух NPC в сумме не меньше меньшей из дальностей
+    path.clear();
+    size_t n = npc.get_path(path);
+    int min_x, min_y, max_x, max_y;
+    path_bounds(path.data(), n, min_x, min_y, max_x, max_y);
+    int pad = (table->kill_distance(npc.species()) + 1) / 2;
+    c0 = regions.col(min_x - pad);
+    r0 = regions.row(min_y - pad);
+    c1 = regions.col(max_x + pad);
+    r1 = regions.row(max_y + pad);
+}
+
+void ActiveRegions::add(NPC& npc)
+{
+    // Вид без правил боя никогда не будит район
+    if (!table->can_fight(npc.species())) return;
+
+    Entry& e = entries[&npc];
+    e = Entry{&npc, next_order++, npc.species(), 0, 0, -1, -1, 0};
+
+    int c0, r0, c1, r1;
+    bounds(npc, c0, r0, c1, r1);
+    place(e, c0, r0, c1, r1);
+}
+
+void ActiveRegions::update(NPC& npc)
+{
+    auto it = entries.find(&npc);
+    if (it == entries.end()) return;
+
+    Entry& e = it->second;
+    int c0, r0, c1, r1;
+    bounds(npc, c0, r0, c1, r1);
+    if (c0 == e.c0 && r0 == e.r0 && c1 == e.c1 && r1 == e.r1) return;
+    place(e, c0, r0, c1, r1);
+}
+
+void ActiveRegions::remove(NPC& npc)
+{
+    auto it = entries.find(&npc);
+    if (it == entries.end()) return;
+
+    place(it->second, 0, 0, -1, -1);
+    entries.erase(it);
+}
+
+void ActiveRegions::place(Entry& e, int c0, int r0, int c1, int r1)
+{
+    auto inside = [](int c, int r, int cc0, int rr0, int cc1, int rr1)
+    {
+        return c >= cc0 && c <= cc1 && r >= rr0 && r <= rr1;
+    };
+
+    for (int r = e.r0; r <= e.r1; ++r)
+        for (int c = e.c0; c <= e.c1; ++c)
+            if (!inside(c, r, c0, r0, c1, r1))
+                leave(e, r * regions.cols + c);
+
+    for (int r = r0; r <= r1; ++r)
+        for (int c = c0; c <= c1; ++c)
+            if (!inside(c, r, e.c0, e.r0, e.c1, e.r1))
+                enter(e, r * regions.cols + c);
+
+    e.c0 = c0;
+    e.r0 = r0;
+    e.c1 = c1;
+    e.r1 = r1;
+}
+
+void ActiveRegions::enter(Entry& e, int region)
+{
+    members[region].insert(&e);
+    change_count(region, e.species, +1);
+}
+
+void ActiveRegions::leave(Entry& e, int region)
+{
+    members[region].erase(&e);
+    change_count(region, e.species, -1);
+}
+
+bool ActiveRegions::pair_live(int region, int attacker, int victim) const
+{
+    const int* c = &counts[region * species_count];
+    return table->can_kill(attacker, victim) &&
+           c[attacker] > 0 && c[victim] > (attacker == victim ? 1 : 0);
+}
+
+void ActiveRegions::change_count(int region, int species, int delta)
+{
+    int& count = counts[region * species_count + species];
+    int old_count = count;
+    count += delta;
+
+    // Живость пар меняется только при переходах через 0, 1 и 2
+    if (std::min(old_count, count) >= 2) return;
+
+    auto live_with = [&](int other)
+    {
+        int n = pair_live(region, species, other) ? 1 : 0;
+        if (other != species && pair_live(region, other, species)) ++n;
+        return n;
+    };
+
+    int after = 0;
+    for (int other : partners[species])
+        after += live_with(other);
+
+    count = old_count;
+    int before = 0;
+    for (int other : partners[species])
+        before += live_with(other);
+    count += delta;
+
+    live_pairs[region] += after - before;
+}
+
+bool ActiveRegions::is_active(int region_col, int region_row) const
+{
+    return live_pairs[region_row * regions.cols + region_col] > 0;
+}
+
+int ActiveRegions::active_count() const
+{
+    return static_cast<int>(std::count_if(live_pairs.begin(), live_pairs.end(),
+                                          [](int n){ return n > 0; }));
+}
+
+void ActiveRegions::collect(vector<NPC*>& out)
+{
+    vector<Entry*> picked;
+    ++current_stamp;
+
+    for (size_t region = 0; region < members.size(); ++region)
+    {
+        if (live_pairs[region] == 0) continue;
+
+        for (Entry* e : members[region])
+        {
+            if (e->stamp == current_stamp) continue;
+            e->stamp = current_stamp;
+            picked.push_back(e);
+        }
+    }
+
+    std::sort(picked.begin(), picked.end(),
+              [](const Entry* a, const Entry* b){ return a->order < b->order; });
+
+    out.clear();
+    for (Entry* e : picked)
+        out.push_back(e->npc);
+}
+
+//================ Engines ==================
+void movement_tick(vector<shared_ptr<NPC>>& npcs,
+                   std::mt19937& gen,
+                   WorldStats* stats,
+                   ActiveRegions* regions)
+{
+    for (auto& npc : npcs)
+    {
+        if (npc->is_alive())
+        {
+            // Перемещаем NPC
+            auto [old_x, old_y] = npc->get_position();
+            npc->move_random(gen);
+            if (stats)
+            {
+                auto [new_x, new_y] = npc->get_position();
+                stats->on_move(old_x, old_y, new_x, new_y);
+            }
+            if (regions)
+                regions->update(*npc);
+        }
+    }
+}
+
+// Общее завершение шага боя: новые пути и удаление мертвых.
+// Районы после сброса путей не пересчитываются: старые остаются
+// надмножеством и уточнятся при следующем ходе.
+static void finish_battle_tick(vector<shared_ptr<NPC>>& npcs, ActiveRegions* regions = nullptr)
+{
+    for (auto& npc : npcs)
+        npc->reset_path();
+    
+    npcs.erase(std::remove_if(npcs.begin(), npcs.end(),
+        [regions](auto& n)
+        {
+            if (n->is_alive()) return false;
+            if (regions) regions->remove(*n);
+            return true;
+        }), npcs.end());
+}
+
+// Бой пары NPC, сблизившихся на дистанцию убийства
+static void fight(NPC& a, NPC& b, KillDispatcher& dispatcher, std::mt19937& gen, WorldStats* stats)
+{
+    // NPC a атакует NPC b
+    BattleVisitor visitor_a(a, dispatcher, gen, stats);
+    b.accept(visitor_a);
     
-    if (attacker.type() == "Orc")
+    // NPC b атакует NPC a (если выжил)
+    if (a.is_alive() && b.is_alive())
     {
-        if (roll_dice_battle())
+        BattleVisitor visitor_b(b, dispatcher, gen, stats);
+        a.accept(visitor_b);
+    }
+}
+
+void battle_tick_reference(vector<shared_ptr<NPC>>& npcs,
+                           KillDispatcher& dispatcher,
+                           std::mt19937& gen,
+                           WorldStats* stats)
+{
+    vector<Sweep> path_i, path_j;
+    
+    // Проверяем все пары NPC на возможность боя
+    for (size_t i = 0; i < npcs.size(); ++i)
+    {
+        if (!npcs[i]->is_alive()) continue;
+        
+        for (size_t j = i + 1; j < npcs.size(); ++j)
         {
-            npc.kill(); 
-            notify(npc.get_name());
+            if (!npcs[j]->is_alive()) continue;
+            
+            path_i.clear();
+            path_j.clear();
+            size_t ni = npcs[i]->get_path(path_i);
+            size_t nj = npcs[j]->get_path(path_j);
+            double distance = closest_approach(path_i.data(), ni, path_j.data(), nj);
+            
+            // Проверяем, могут ли NPC атаковать друг друга
+            if (distance <= npcs[i]->get_kill_distance() && 
+                distance <= npcs[j]->get_kill_distance())
+            {
+                fight(*npcs[i], *npcs[j], dispatcher, gen, stats);
+            }
         }
     }
+    
+    finish_battle_tick(npcs);
 }
 
-void BattleVisitor::visit(Squirrel& npc)
+BattleEngine::BattleEngine()
+    : table(SpeciesTable::current()),
+      grid(std::max(GRID_CELL_SIZE, table->max_kill_distance())) {}
+
+void BattleEngine::tick(vector<shared_ptr<NPC>>& npcs,
+                        KillDispatcher& dispatcher,
+                        std::mt19937& gen,
+                        WorldStats* stats,
+                        ActiveRegions* regions)
 {
-    // Белки не атакуют и не могут быть атакованы по текущей логике
-    (void)npc; // Используем параметр, чтобы избежать предупреждения
+    
+    // Участники шага: NPC бодрствующих районов или все, кто участвует
+    // в правилах боя; порядок тот же, что в списке npcs
+    if (regions)
+    {
+        regions->collect(roster);
+    }
+    else
+    {
+        roster.clear();
+        for (auto& npc : npcs)
+            if (table->can_fight(npc->species()))
+                roster.push_back(npc.get());
+    }
+    
+    // Раскладываем по сетке пути живых участников
+    int count = static_cast<int>(roster.size());
+    segments.clear();
+    path_begin.assign(count, 0);
+    path_size.assign(count, 0);
+    grid.clear();
+    for (int i = 0; i < count; ++i)
+    {
+        if (!roster[i]->is_alive()) continue;
+        
+        path_begin[i] = segments.size();
+        path_size[i] = roster[i]->get_path(segments);
+        int min_x, min_y, max_x, max_y;
+        path_bounds(&segments[path_begin[i]], path_size[i], min_x, min_y, max_x, max_y);
+        grid.insert(i, min_x, min_y, max_x, max_y);
+    }
+    
+    // Проверяем пары NPC, чьи пути сближались на дистанцию боя
+    for (int i = 0; i < count; ++i)
+    {
+        NPC& a = *roster[i];
+        if (!a.is_alive()) continue;
+        
+        int species_i = a.species();
+        const Sweep* pi = &segments[path_begin[i]];
+        int reach = table->kill_distance(species_i);
+        int min_x, min_y, max_x, max_y;
+        path_bounds(pi, path_size[i], min_x, min_y, max_x, max_y);
+        grid.query(min_x - reach, min_y - reach, max_x + reach, max_y + reach, candidates);
+        // Сохраняем порядок обхода пар, как в полном переборе
+        std::sort(candidates.begin(), candidates.end());
+        
+        for (int j : candidates)
+        {
+            if (j <= i) continue;
+            NPC& b = *roster[j];
+            int species_j = b.species();
+            // Пара без правил боя не влияет на исход
+            if (!table->can_kill(species_i, species_j) &&
+                !table->can_kill(species_j, species_i)) continue;
+            if (!b.is_alive()) continue;
+            
+            double distance = closest_approach(pi, path_size[i],
+                                               &segments[path_begin[j]], path_size[j]);
+            
+            // Проверяем, могут ли NPC атаковать друг друга
+            if (distance <= reach && 
+                distance <= table->kill_distance(species_j))
+            {
+                fight(a, b, dispatcher, gen, stats);
+            }
+        }
+    }
+    
+    finish_battle_tick(npcs, regions);
+}
+
+void single_round_reference(vector<shared_ptr<NPC>>& npcs,
+                            double range,
+                            KillDispatcher& dispatcher,
+                            std::mt19937& gen)
+{
+    for (auto& a : npcs)
+        for (auto& b : npcs)
+            if (a != b && a->is_alive() && b->is_alive() &&
+                a->distance_to(*b) <= range)
+            {
+                BattleVisitor v(*a, dispatcher, gen);
+                b->accept(v);
+            }
+
+    npcs.erase(std::remove_if(npcs.begin(), npcs.end(),
+        [](auto& n){ return !n->is_alive(); }), npcs.end());
+}
+
+void single_round(vector<shared_ptr<NPC>>& npcs,
+                  double range,
+                  KillDispatcher& dispatcher,
+                  std::mt19937& gen)
+{
+    auto table = SpeciesTable::current();
+    
+    // Отрицательная дальность не дает ни одной пары
+    if (!(range >= 0.0))
+    {
+        single_round_reference(npcs, range, dispatcher, gen);
+        return;
+    }
+    
+    // Дальность за пределами карты эквивалентна всей карте
+    int reach = static_cast<int>(std::ceil(std::min(range, double(MAP_WIDTH + MAP_HEIGHT))));
+    
+    SpatialGrid grid(std::max(GRID_CELL_SIZE, reach));
+    int count = static_cast<int>(npcs.size());
+    for (int i = 0; i < count; ++i)
+    {
+        if (!table->can_fight(npcs[i]->species())) continue;
+        auto [x, y] = npcs[i]->get_position();
+        grid.insert(i, x, y, x, y);
+    }
+    
+    vector<int> candidates;
+    for (int i = 0; i < count; ++i)
+    {
+        int species_a = npcs[i]->species();
+        if (!table->can_fight(species_a)) continue;
+        
+        auto [x, y] = npcs[i]->get_position();
+        grid.query(x - reach, y - reach, x + reach, y + reach, candidates);
+        // Порядок атак как в полном переборе
+        std::sort(candidates.begin(), candidates.end());
+        
+        for (int j : candidates)
+        {
+            // Бросок кубика делает только тот, кто может убить
+            if (j == i || !table->can_kill(species_a, npcs[j]->species())) continue;
+            if (npcs[i]->is_alive() && npcs[j]->is_alive() &&
+                npcs[i]->distance_to(*npcs[j]) <= range)
+            {
+                BattleVisitor v(*npcs[i], dispatcher, gen);
+                npcs[j]->accept(v);
+            }
+        }
+    }
+    
+    npcs.erase(std::remove_if(npcs.begin(), npcs.end(),
+        [](auto& n){ return !n->is_alive(); }), npcs.end());
 }
 
 //================ Game Manager =============
 GameManager::GameManager()
 {
-    observers.push_back(make_shared<ConsoleObserver>());
-    observers.push_back(make_shared<FileObserver>("battle_log.txt"));
+    dispatcher.subscribe(make_shared<ConsoleObserver>());
+    dispatcher.subscribe(make_shared<FileObserver>("battle_log.txt"));
 }
 
 GameManager::~GameManager()
@@ -261,11 +1146,17 @@ void GameManager::initialize_game()
     {
         std::lock_guard<std::mutex> lock(npcs_mutex);
         npcs.clear();
+        stats.reset();
+        regions.clear();
         
         // Создаем 50 случайных NPC
         for (int i = 0; i < 50; ++i)
         {
-            npcs.push_back(NPCFactory::create_random("NPC_", gen));
+            auto npc = NPCFactory::create_random("NPC_", gen);
+            auto [x, y] = npc->get_position();
+            stats.on_spawn(npc->species(), x, y);
+            regions.add(*npc);
+            npcs.push_back(npc);
         }
     }
     
@@ -277,7 +1168,13 @@ void GameManager::initialize_game()
 
 void GameManager::start_game()
 {
-    game_running = true;
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        game_running = true;
+        game_over = false;
+        end_reason = nullptr;
+        battle_ticks = 0;
+    }
     
     // Запускаем потоки
     movement_thread = std::thread(&GameManager::movement_worker, this);
@@ -292,7 +1189,11 @@ void GameManager::start_game()
 
 void GameManager::stop_game()
 {
-    game_running = false;
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        game_running = false;
+    }
+    wake_cv.notify_all();
     
     if (movement_thread.joinable()) movement_thread.join();
     if (battle_thread.joinable()) battle_thread.join();
@@ -306,10 +1207,62 @@ void GameManager::run_game()
     initialize_game();
     start_game();
     
-    // Ждем указанное время
-    std::this_thread::sleep_for(std::chrono::seconds(GAME_DURATION_SECONDS));
+    // Ждем указанное время или срабатывания условия завершения
+    const char* reason = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        wake_cv.wait_for(lock, std::chrono::seconds(GAME_DURATION_SECONDS),
+                         [this]{ return game_over; });
+        reason = end_reason;
+    }
+    
+    if (reason)
+    {
+        std::lock_guard<std::mutex> lock(cout_mutex);
+        cout << "Игра завершена досрочно: " << reason << endl;
+    }
     
     stop_game();
+    stats.export_csv("stats.csv");
+}
+
+void GameManager::set_end_conditions(const EndConditions& conditions)
+{
+    end_conditions = conditions;
+}
+
+bool GameManager::wait_tick(std::chrono::milliseconds period)
+{
+    // Ожидание прерывается сразу, как только игру останавливают
+    std::unique_lock<std::mutex> lock(wake_mutex);
+    return !wake_cv.wait_for(lock, period, [this]{ return !game_running; });
+}
+
+const char* GameManager::check_end_conditions() const
+{
+    // Все проверки читают только счетчики статистики
+    if (end_conditions.max_ticks > 0 && battle_ticks >= end_conditions.max_ticks)
+        return "достигнут лимит тиков";
+    if (end_conditions.min_population > 0 && stats.alive_total() < end_conditions.min_population)
+        return "популяция ниже порога";
+    if (end_conditions.until_one_species && stats.species_alive() <= 1)
+        return "остался один вид";
+    if (end_conditions.until_stalemate)
+    {
+        const SpeciesTable& table = stats.species_table();
+        for (int k = 0; k < table.count(); ++k)
+        {
+            if (stats.alive(k) == 0) continue;
+            for (int v = 0; v < table.count(); ++v)
+            {
+                // Для боя внутри вида нужны хотя бы двое
+                if (table.can_kill(k, v) && stats.alive(v) > (k == v ? 1 : 0))
+                    return nullptr;
+            }
+        }
+        return "боев больше не будет";
+    }
+    return nullptr;
 }
 
 void GameManager::movement_worker()
@@ -317,20 +1270,10 @@ void GameManager::movement_worker()
     std::random_device rd;
     std::mt19937 gen(rd());
     
-    while (game_running)
+    while (wait_tick(std::chrono::milliseconds(MOVEMENT_TICK_MS)))
     {
-        std::this_thread::sleep_for(std::chrono::milliseconds(100)); // 10 раз в секунду
-        
         std::lock_guard<std::mutex> lock(npcs_mutex);
-        
-        for (auto& npc : npcs)
-        {
-            if (npc->is_alive())
-            {
-                // Перемещаем NPC
-                npc->move_random(gen);
-            }
-        }
+        movement_tick(npcs, gen, &stats, &regions);
     }
 }
 
@@ -338,67 +1281,40 @@ void GameManager::battle_worker()
 {
     std::random_device rd;
     std::mt19937 gen(rd());
+    BattleEngine engine;
     
-    while (game_running)
+    while (wait_tick(std::chrono::milliseconds(BATTLE_TICK_MS)))
     {
-        std::this_thread::sleep_for(std::chrono::milliseconds(200)); // 5 раз в секунду
-        
         std::lock_guard<std::mutex> lock(npcs_mutex);
+        engine.tick(npcs, dispatcher, gen, &stats, &regions);
+        
+        stats.end_tick();
         
-        // Проверяем все пары NPC на возможность боя
-        for (size_t i = 0; i < npcs.size(); ++i)
+        // Будим run_game, если игра может завершиться досрочно
+        std::lock_guard<std::mutex> wake_lock(wake_mutex);
+        ++battle_ticks;
+        if (!game_over && (end_reason = check_end_conditions()))
         {
-            if (!npcs[i]->is_alive()) continue;
-            
-            for (size_t j = i + 1; j < npcs.size(); ++j)
-            {
-                if (!npcs[j]->is_alive()) continue;
-                
-                double distance = npcs[i]->distance_to(*npcs[j]);
-                
-                // Проверяем, могут ли NPC атаковать друг друга
-                if (distance <= npcs[i]->get_kill_distance() && 
-                    distance <= npcs[j]->get_kill_distance())
-                {
-                    // NPC i атакует NPC j
-                    BattleVisitor visitor_i(*npcs[i], observers, gen);
-                    npcs[j]->accept(visitor_i);
-                    
-                    // NPC j атакует NPC i (если выжил)
-                    if (npcs[i]->is_alive() && npcs[j]->is_alive())
-                    {
-                        BattleVisitor visitor_j(*npcs[j], observers, gen);
-                        npcs[i]->accept(visitor_j);
-                    }
-                }
-            }
+            game_over = true;
+            wake_cv.notify_all();
         }
-        
-        // Удаляем мертвых NPC
-        npcs.erase(std::remove_if(npcs.begin(), npcs.end(),
-            [](auto& n){ return !n->is_alive(); }), npcs.end());
     }
 }
 
 void GameManager::display_worker()
 {
-    while (game_running)
+    while (wait_tick(std::chrono::seconds(1))) // Раз в секунду
     {
-        std::this_thread::sleep_for(std::chrono::seconds(1)); // Раз в секунду
-        
         print_map();
         
         {
+            // Счетчики поддерживаются статистикой, список NPC не обходится
+            const SpeciesTable& table = stats.species_table();
             std::lock_guard<std::mutex> lock(cout_mutex);
-            cout << "Живых NPC: ";
-            
-            std::lock_guard<std::mutex> npc_lock(npcs_mutex);
-            int alive_count = 0;
-            for (auto& npc : npcs)
-            {
-                if (npc->is_alive()) ++alive_count;
-            }
-            cout << alive_count << endl;
+            cout << "Живых NPC: " << stats.alive_total() << " (";
+            for (int s = 0; s < table.count(); ++s)
+                cout << (s ? ", " : "") << table.name(s) << ": " << stats.alive(s);
+            cout << ")" << endl;
         }
     }
 }
@@ -409,7 +1325,11 @@ void GameManager::print_survivors() const
     std::lock_guard<std::mutex> npc_lock(npcs_mutex);
     
     cout << "\n=== ВЫЖИВШИЕ NPC ===" << endl;
-    cout << "Всего выжило: " << npcs.size() << endl;
+    cout << "Всего выжило: " << stats.alive_total() << endl;
+    
+    const SpeciesTable& table = stats.species_table();
+    for (int s = 0; s < table.count(); ++s)
+        cout << "  " << table.name(s) << ": " << stats.alive(s) << endl;
     
     for (auto& npc : npcs)
     {
@@ -460,12 +1380,15 @@ void GameManager::print_map() const
 void GameManager::add_npc(shared_ptr<NPC> npc)
 {
     std::lock_guard<std::mutex> lock(npcs_mutex);
+    auto [x, y] = npc->get_position();
+    stats.on_spawn(npc->species(), x, y);
+    regions.add(*npc);
     npcs.push_back(npc);
 }
 
-void GameManager::add_observer(shared_ptr<Observer> observer)
+void GameManager::add_observer(shared_ptr<Observer> observer, const KillFilter& filter)
 {
-    observers.push_back(observer);
+    dispatcher.subscribe(observer, filter);
 }
 
 //================ File ops =================
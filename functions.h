@@ -11,6 +11,14 @@
 #include <fstream>
 #include <random>
 #include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <unordered_map>
+#include <unordered_set>
+#include <list>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
 
 using std::string;
 using std::vector;
@@ -21,6 +29,16 @@ const int MAP_WIDTH = 100;
 const int MAP_HEIGHT = 100;
 const int GAME_DURATION_SECONDS = 30;
 
+// Периоды тиков потоков (мс)
+const int MOVEMENT_TICK_MS = 100;
+const int BATTLE_TICK_MS = 200;
+
+// Размер ячейки пространственной сетки (не меньше максимальной дальности убийства)
+const int GRID_CELL_SIZE = 10;
+
+// Сторона района карты, общая для рассылки убийств, статистики и активных районов
+const int MAP_REGION_SIZE = 20;
+
 // Глобальный мьютекс для cout
 extern std::mutex cout_mutex;
 
@@ -50,38 +68,228 @@ private:
     std::mutex file_mutex;
 };
 
+//================ Regions ================
+// Разбиение карты на квадратные районы. Координаты за картой
+// прижимаются к крайнему району.
+struct RegionGrid
+{
+    int size;
+    int cols;
+    int rows;
+
+    explicit RegionGrid(int region_size, int width = MAP_WIDTH, int height = MAP_HEIGHT)
+        : size(region_size),
+          cols((width + region_size - 1) / region_size),
+          rows((height + region_size - 1) / region_size) {}
+
+    int col(int x) const { return std::clamp(x / size, 0, cols - 1); }
+    int row(int y) const { return std::clamp(y / size, 0, rows - 1); }
+    int index(int x, int y) const { return row(y) * cols + col(x); }
+    int count() const { return cols * rows; }
+};
+
+//================ Species ================
+// Таблица видов NPC: дальности и матрица «хищник/жертва».
+// Собирается из конфигурационного файла при старте и дальше только читается.
+class SpeciesTable
+{
+public:
+    // Текущая таблица видов. NPC и движки держат свою копию указателя,
+    // поэтому таблица не меняется, пока ими пользуются.
+    static shared_ptr<const SpeciesTable> current();
+    // Делает таблицу текущей; заменить таблицу, которую кто-то держит, нельзя
+    static void install(shared_ptr<const SpeciesTable> table);
+    // Загружает виды из файла и делает их текущими; если файла нет, остаются встроенные виды
+    static bool load(const string& filename);
+    static shared_ptr<const SpeciesTable> parse(std::istream& in);
+    // Встроенные виды: species.txt на момент сборки
+    static const char* default_config();
+
+    int count() const { return static_cast<int>(names.size()); }
+    int find(const string& name) const; // -1, если вида нет
+    const string& name(int id) const { return names[id]; }
+    int move_distance(int id) const { return moves[id]; }
+    int kill_distance(int id) const { return kills[id]; }
+    bool can_kill(int attacker, int victim) const { return eats[attacker * count() + victim]; }
+    // Вид участвует хотя бы в одной паре «хищник/жертва»
+    bool can_fight(int id) const { return fights[id]; }
+    int max_kill_distance() const { return max_kill; }
+    string list_names() const;
+
+private:
+    SpeciesTable() = default;
+
+    vector<string> names;
+    vector<int> moves;
+    vector<int> kills;
+    vector<unsigned char> eats;   // count() x count(), строка - атакующий
+    vector<unsigned char> fights;
+    int max_kill = 0;
+};
+
+//================ Kill dispatch ===========
+class NPC;
+
+// Фильтр подписки наблюдателя на события убийств
+struct KillFilter
+{
+    // Область карты (включительно), где должна погибнуть жертва
+    int min_x = 0;
+    int min_y = 0;
+    int max_x = MAP_WIDTH - 1;
+    int max_y = MAP_HEIGHT - 1;
+    int killer_species = -1; // -1 - любой вид
+    int victim_species = -1;
+    int sample_every = 1;    // Доставлять каждое N-е подходящее событие
+};
+
+// Рассылка убийств только тем наблюдателям, чей фильтр подходит.
+// Подписка попадает ровно в одну группу «вид убийцы x вид жертвы», где
+// «любой вид» - отдельное значение, а внутри группы - в районы своей области
+// или в общий список, если область накрывает всю карту. Событие проверяет
+// четыре группы (точная пара и три с «любым») и только свой район в них.
+// В пределах одного списка события доставляются в порядке подписки.
+class KillDispatcher
+{
+public:
+    KillDispatcher();
+
+    void subscribe(shared_ptr<Observer> observer, const KillFilter& filter = KillFilter());
+    void dispatch(NPC& killer, NPC& victim);
+    size_t size() const;
+
+private:
+    struct Subscription
+    {
+        shared_ptr<Observer> observer;
+        KillFilter filter;
+        std::atomic<unsigned long> seen{0};
+    };
+
+    // Запись корзины: область хранится рядом, чтобы проверка не ходила по указателю
+    struct Route
+    {
+        int min_x, min_y, max_x, max_y;
+        Subscription* sub;
+    };
+
+    struct Group
+    {
+        vector<vector<Route>> by_region; // Пусто, пока нет подписок с областью
+        vector<Route> everywhere;        // Подписки на всю карту
+    };
+
+    shared_ptr<const SpeciesTable> table;
+    int species_count;
+    RegionGrid regions{MAP_REGION_SIZE};
+    vector<std::unique_ptr<Subscription>> subscriptions;
+    vector<int> group_index; // [(убийца + 1) * (видов + 1) + жертва + 1], -1 - группы нет
+    vector<Group> groups;
+
+    int group_key(int killer, int victim) const { return (killer + 1) * (species_count + 1) + victim + 1; }
+
+    mutable std::shared_mutex mtx;
+};
+
+//================ Statistics ==============
+// Срез статистики на конец тика боя
+struct StatsSample
+{
+    long tick;
+    vector<long> alive; // Живые по видам
+    vector<long> kills; // Убийства за тик, [убийца * видов + жертва]
+};
+
+// Статистика мира, обновляемая за O(1) на событие рождения, хода и убийства.
+// Чтение не требует обхода списка NPC.
+class WorldStats
+{
+public:
+    // Плотность считается по районам regions
+    explicit WorldStats(const RegionGrid& regions = RegionGrid(MAP_REGION_SIZE));
+
+    void reset();
+    void on_spawn(int species, int x, int y);
+    void on_move(int old_x, int old_y, int new_x, int new_y);
+    void on_kill(int killer, int victim, int x, int y);
+    // Закрывает тик и добавляет срез во временной ряд
+    void end_tick();
+
+    long alive_total() const;
+    long alive(int species) const;
+    int species_alive() const; // Сколько видов еще не вымерло
+    long kills(int killer, int victim) const;
+    long density(int region_col, int region_row) const;
+
+    vector<StatsSample> series() const;
+    void export_csv(const string& filename) const;
+    const SpeciesTable& species_table() const { return *table; }
+    const RegionGrid& region_grid() const { return regions; }
+
+private:
+    shared_ptr<const SpeciesTable> table;
+    int species_count;
+    RegionGrid regions;
+    std::atomic<long> total{0};
+    vector<std::atomic<long>> alive_by_species;
+    vector<std::atomic<long>> kills_by_pair;
+    vector<std::atomic<long>> density_by_region;
+
+    mutable std::mutex series_mutex;
+    vector<StatsSample> samples;
+    vector<long> kills_at_last_tick;
+
+};
+
 //================ Visitor ================
-class Orc;
-class Bear;
-class Squirrel;
 
 class Visitor
 {
 public:
     virtual ~Visitor() = default;
-    virtual void visit(Orc&) = 0;
-    virtual void visit(Bear&) = 0;
-    virtual void visit(Squirrel&) = 0;
+    virtual void visit(NPC&) = 0;
+};
+
+//================ Sweep ==================
+// Отрезок перемещения NPC за один ход
+struct Sweep
+{
+    int x0, y0; // Начало отрезка
+    int x1, y1; // Конец отрезка
 };
 
+// Минимальное расстояние между двумя NPC, движущимися равномерно по своим отрезкам
+double closest_approach(const Sweep& a, const Sweep& b);
+// То же для путей из нескольких ходов. Пути выровнены по последнему ходу:
+// до первого хода более короткого пути его NPC стоит в начале пути.
+double closest_approach(const Sweep* a, size_t na, const Sweep* b, size_t nb);
+// Ограничивающий прямоугольник пути
+void path_bounds(const Sweep* path, size_t n, int& min_x, int& min_y, int& max_x, int& max_y);
+
 //================ NPC ====================
 class NPC
 {
 protected:
+    shared_ptr<const SpeciesTable> table; // Таблица, по которой создан NPC
+    int species_id;
     string name;
     int x;
     int y;
+    vector<Sweep> path; // Ходы с момента последней проверки боя
     bool alive;
     mutable std::shared_mutex mtx;
 
 public:
-    NPC(const string& name, int x, int y);
+    NPC(int species, const string& name, int x, int y);
     virtual ~NPC() = default;
 
-    virtual string type() const = 0;
-    virtual void accept(Visitor& v) = 0;
-    virtual int get_move_distance() const = 0;
-    virtual int get_kill_distance() const = 0;
+    // Вид не меняется после создания, поэтому читается без блокировки
+    int species() const { return species_id; }
+    const SpeciesTable& species_table() const { return *table; }
+    string type() const;
+    void accept(Visitor& v);
+    int get_move_distance() const;
+    int get_kill_distance() const;
     
     // Потокобезопасные методы
     double distance_to(int other_x, int other_y) const;
@@ -93,6 +301,12 @@ public:
     void move(int dx, int dy);
     void move_random(std::mt19937& gen);
     
+    // Путь для непрерывной проверки столкновений: по отрезку на ход.
+    // Дописывает отрезки в out и возвращает их число; без ходов -
+    // один нулевой отрезок в текущей позиции.
+    size_t get_path(vector<Sweep>& out) const;
+    void reset_path();
+    
     // Геттеры с блокировкой
     string get_name() const;
     std::pair<int, int> get_position() const;
@@ -103,36 +317,6 @@ public:
     char get_symbol() const;
 };
 
-class Orc : public NPC
-{
-public:
-    Orc(const string& name, int x, int y);
-    string type() const override;
-    void accept(Visitor& v) override;
-    int get_move_distance() const override;
-    int get_kill_distance() const override;
-};
-
-class Bear : public NPC
-{
-public:
-    Bear(const string& name, int x, int y);
-    string type() const override;
-    void accept(Visitor& v) override;
-    int get_move_distance() const override;
-    int get_kill_distance() const override;
-};
-
-class Squirrel : public NPC
-{
-public:
-    Squirrel(const string& name, int x, int y);
-    string type() const override;
-    void accept(Visitor& v) override;
-    int get_move_distance() const override;
-    int get_kill_distance() const override;
-};
-
 //================ Factory =================
 class NPCFactory
 {
@@ -144,37 +328,192 @@ public:
     static shared_ptr<NPC> create_random(const string& type_prefix, std::mt19937& gen);
 };
 
+//================ Spatial index ===========
+// Равномерная сетка для поиска кандидатов в бой по ограничивающим прямоугольникам
+class SpatialGrid
+{
+public:
+    explicit SpatialGrid(int cell_size, int width = MAP_WIDTH, int height = MAP_HEIGHT);
+
+    // Сдвигает покрываемую область; точки вне ее попадают в крайние ячейки
+    void set_origin(int x, int y) { origin_x = x; origin_y = y; }
+    size_t cell_count() const { return cells.size(); }
+
+    void clear();
+    void insert(int id, int min_x, int min_y, int max_x, int max_y);
+    // Возвращает id без повторов, чьи прямоугольники попали в те же ячейки
+    void query(int min_x, int min_y, int max_x, int max_y, vector<int>& out);
+
+private:
+    int cell_size;
+    int cols;
+    int rows;
+    int origin_x = 0;
+    int origin_y = 0;
+    vector<vector<int>> cells;
+    vector<unsigned> stamps;
+    unsigned current_stamp = 0;
+
+    int cell_col(int x) const;
+    int cell_row(int y) const;
+};
+
 //================ Battle ==================
 class BattleVisitor : public Visitor
 {
 public:
     BattleVisitor(NPC& attacker,
-                  vector<shared_ptr<Observer>>& observers,
-                  std::mt19937& gen);
+                  KillDispatcher& dispatcher,
+                  std::mt19937& gen,
+                  WorldStats* stats = nullptr);
 
-    void visit(Orc&) override;
-    void visit(Bear&) override;
-    void visit(Squirrel&) override;
+    void visit(NPC&) override;
 
 private:
     NPC& attacker;
-    vector<shared_ptr<Observer>>& observers;
+    KillDispatcher& dispatcher;
     std::mt19937& gen;
+    WorldStats* stats;
     std::uniform_int_distribution<int> dice{1, 6};
     
-    void notify(const string& victim);
     bool roll_dice_battle();
 };
 
+//================ Active regions ==========
+// Районы карты, где возможен бой. NPC регистрируется во всех районах, которые
+// задевает его отрезок перемещения, расширенный на половину дальности убийства,
+// поэтому пара, способная сразиться, всегда делит хотя бы один район.
+// Район «спит», пока в нем нет ни одной живой пары «хищник/жертва»;
+// счетчики обновляются при входе и выходе NPC, без обхода населения.
+class ActiveRegions
+{
+public:
+    ActiveRegions();
+
+    void clear();
+    // NPC добавляются в том же порядке, в каком лежат в списке npcs
+    void add(NPC& npc);
+    // Пересчет районов после хода NPC
+    void update(NPC& npc);
+    void remove(NPC& npc);
+
+    const RegionGrid& region_grid() const { return regions; }
+    bool is_active(int region_col, int region_row) const;
+    int active_count() const;
+    // NPC из бодрствующих районов без повторов, в порядке добавления
+    void collect(vector<NPC*>& out);
+
+private:
+    struct Entry
+    {
+        NPC* npc;
+        long order;
+        int species;
+        int c0, r0, c1, r1; // Занятые районы (включительно)
+        unsigned stamp;
+    };
+
+    shared_ptr<const SpeciesTable> table;
+    int species_count;
+    RegionGrid regions{MAP_REGION_SIZE};
+    long next_order = 0;
+    unsigned current_stamp = 0;
+    std::unordered_map<const NPC*, Entry> entries;
+    vector<std::unordered_set<Entry*>> members;
+    vector<int> counts;     // [район * видов + вид]
+    vector<int> live_pairs; // Число живых пар «хищник/жертва» в районе
+    vector<vector<int>> partners; // Виды, с которыми вид может сразиться
+    vector<Sweep> path;           // Буфер пути для bounds
+
+    void place(Entry& e, int c0, int r0, int c1, int r1);
+    void enter(Entry& e, int region);
+    void leave(Entry& e, int region);
+    void change_count(int region, int species, int delta);
+    bool pair_live(int region, int attacker, int victim) const;
+    void bounds(const NPC& npc, int& c0, int& r0, int& c1, int& r1);
+};
+
+//================ Engines =================
+// Шаги симуляции без потоков: их вызывает GameManager под npcs_mutex,
+// а проверочный стенд verify_engines сравнивает эталонные и быстрые версии.
+
+// Один шаг перемещения всех живых NPC
+void movement_tick(vector<shared_ptr<NPC>>& npcs,
+                   std::mt19937& gen,
+                   WorldStats* stats = nullptr,
+                   ActiveRegions* regions = nullptr);
+
+// Эталонный шаг боя: полный перебор пар O(n^2)
+void battle_tick_reference(vector<shared_ptr<NPC>>& npcs,
+                           KillDispatcher& dispatcher,
+                           std::mt19937& gen,
+                           WorldStats* stats = nullptr);
+
+// Быстрый шаг боя: кандидаты ищутся по сетке отрезков перемещения,
+// а с ActiveRegions - только среди NPC бодрствующих районов.
+// Порядок боев и бросков кубика совпадает с эталоном.
+class BattleEngine
+{
+public:
+    BattleEngine();
+
+    void tick(vector<shared_ptr<NPC>>& npcs,
+              KillDispatcher& dispatcher,
+              std::mt19937& gen,
+              WorldStats* stats = nullptr,
+              ActiveRegions* regions = nullptr);
+
+private:
+    shared_ptr<const SpeciesTable> table;
+    SpatialGrid grid;
+    vector<NPC*> roster;
+    vector<Sweep> segments;    // Пути участников подряд
+    vector<size_t> path_begin; // Начало пути участника в segments
+    vector<size_t> path_size;
+    vector<int> candidates;
+};
+
+// Одиночный раунд боя из меню: эталонный перебор и версия с сеткой
+void single_round_reference(vector<shared_ptr<NPC>>& npcs,
+                            double range,
+                            KillDispatcher& dispatcher,
+                            std::mt19937& gen);
+void single_round(vector<shared_ptr<NPC>>& npcs,
+                  double range,
+                  KillDispatcher& dispatcher,
+                  std::mt19937& gen);
+
 //================ Game Manager ============
+// Условия досрочного завершения игры (проверяются по статистике после каждого тика боя)
+struct EndConditions
+{
+    bool until_one_species = false; // Остался один вид (или никого)
+    bool until_stalemate = false;   // Не осталось ни одной пары «хищник/жертва»
+    long max_ticks = 0;             // 0 - без ограничения
+    long min_population = 0;        // Остановить, когда живых меньше
+};
+
 class GameManager
 {
 private:
     vector<shared_ptr<NPC>> npcs;
-    vector<shared_ptr<Observer>> observers;
+    KillDispatcher dispatcher;
+    WorldStats stats;
+    ActiveRegions regions;
     std::atomic<bool> game_running{false};
     mutable std::mutex npcs_mutex; // Добавлено mutable
     
+    // Пробуждение потоков при остановке и по условиям завершения
+    std::mutex wake_mutex;
+    std::condition_variable wake_cv;
+    bool game_over = false;
+    const char* end_reason = nullptr;
+    EndConditions end_conditions;
+    long battle_ticks = 0;
+    
+    bool wait_tick(std::chrono::milliseconds period);
+    const char* check_end_conditions() const;
+    
     // Потоки
     std::thread movement_thread;
     std::thread battle_thread;
@@ -188,6 +527,7 @@ public:
     void start_game();
     void stop_game();
     void run_game();
+    void set_end_conditions(const EndConditions& conditions);
     
     void movement_worker();
     void battle_worker();
@@ -195,10 +535,11 @@ public:
     
     void print_survivors() const;
     void print_map() const;
+    const WorldStats& get_stats() const { return stats; }
     
     // Для тестирования
     void add_npc(shared_ptr<NPC> npc);
-    void add_observer(shared_ptr<Observer> observer);
+    void add_observer(shared_ptr<Observer> observer, const KillFilter& filter = KillFilter());
 };
 
 //================ File ops ================
@@ -1,4 +1,7 @@
 #include "functions.h"
+#ifdef RPG_OUT_OF_CORE
+#include "out_of_core.h"
+#endif
 #include <iostream>
 #include <algorithm>
 #include <chrono>
@@ -9,14 +12,66 @@ using std::cout;
 using std::endl;
 using std::make_shared;
 
+#ifdef RPG_OUT_OF_CORE
+void run_out_of_core()
+{
+    unsigned long long count;
+    size_t budget_mb;
+    int ticks;
+    string directory;
+    cout << "Число NPC: "; cin >> count;
+    cout << "Бюджет памяти (МБ): "; cin >> budget_mb;
+    cout << "Число тиков: "; cin >> ticks;
+    // /tmp часто в tmpfs, то есть в памяти: файл мира лучше держать на диске
+    cout << "Каталог для файла мира на диске (. - текущий): "; cin >> directory;
+    
+    try
+    {
+        // Мир растет вместе с населением, чтобы плотность и число боев на NPC не менялись
+        OutOfCoreConfig config;
+        config.side = OutOfCoreWorld::side_for(count);
+        config.budget_bytes = budget_mb * 1024 * 1024;
+        config.parent_directory = directory;
+        OutOfCoreWorld world(config);
+        cout << "Размер мира: " << world.side() << "x" << world.side() << endl;
+        cout << "Каталог мира: " << world.get_store().directory() << endl;
+        std::random_device rd;
+        std::mt19937 gen(rd());
+        
+        auto start_time = std::chrono::steady_clock::now();
+        world.populate(count, gen);
+        for (int t = 1; t <= ticks; ++t)
+        {
+            world.movement_tick(gen);
+            world.battle_tick(gen);
+            cout << "Тик " << t << ": живых " << world.get_stats().alive_total() << endl;
+        }
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start_time);
+        
+        cout << "Пик памяти мира: " << world.peak_bytes() / 1024 << " КБ" << endl;
+        cout << "Время: " << duration.count() / 1000.0 << " секунд" << endl;
+    }
+    catch (const std::exception& e)
+    {
+        cout << "Ошибка: " << e.what() << endl;
+    }
+}
+#endif
+
 void run_simulation()
 {
     GameManager game;
     
+    // Завершаем раньше, если исход уже предрешен
+    EndConditions conditions;
+    conditions.until_stalemate = true;
+    game.set_end_conditions(conditions);
+    
     {
         std::lock_guard<std::mutex> lock(cout_mutex);
         cout << "Запуск симуляции..." << endl;
-        cout << "Длительность: " << GAME_DURATION_SECONDS << " секунд" << endl;
+        cout << "Длительность: до " << GAME_DURATION_SECONDS << " секунд" << endl;
         cout << "Размер карты: " << MAP_WIDTH << "x" << MAP_HEIGHT << endl;
     }
     
@@ -24,21 +79,30 @@ void run_simulation()
     game.run_game();
     auto end_time = std::chrono::high_resolution_clock::now();
     
-    auto duration = std::chrono::duration_cast<std::chrono::seconds>(end_time - start_time);
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
     
     {
         std::lock_guard<std::mutex> lock(cout_mutex);
-        cout << "Симуляция завершена за " << duration.count() << " секунд." << endl;
+        cout << "Симуляция завершена за " << duration.count() / 1000.0 << " секунд." << endl;
     }
 }
 
 int main()
 {
+    try
+    {
+        SpeciesTable::load("species.txt");
+    }
+    catch (const std::exception& e)
+    {
+        cout << "Ошибка в species.txt: " << e.what() << endl;
+        return 1;
+    }
+
     vector<shared_ptr<NPC>> npcs;
-    vector<shared_ptr<Observer>> observers{
-        make_shared<ConsoleObserver>(),
-        make_shared<FileObserver>("log.txt")
-    };
+    KillDispatcher dispatcher;
+    dispatcher.subscribe(make_shared<ConsoleObserver>());
+    dispatcher.subscribe(make_shared<FileObserver>("log.txt"));
 
     int choice;
     do
@@ -49,7 +113,10 @@ int main()
         cout << "3 - Сохранить" << endl;
         cout << "4 - Загрузить" << endl;
         cout << "5 - Запуск боя (одиночный раунд)" << endl;
-        cout << "6 - Запуск полной симуляции (30 секунд)" << endl;
+        cout << "6 - Запуск полной симуляции (до " << GAME_DURATION_SECONDS << " секунд)" << endl;
+#ifdef RPG_OUT_OF_CORE
+        cout << "7 - Большой мир на диске" << endl;
+#endif
         cout << "0 - Выход" << endl;
         cout << "Выбор: ";
         cin >> choice;
@@ -58,7 +125,7 @@ int main()
         {
             string type, name;
             int x, y;
-            cout << "Тип (Orc/Bear/Squirrel): "; cin >> type;
+            cout << "Тип (" << SpeciesTable::current()->list_names() << "): "; cin >> type;
             cout << "Имя: "; cin >> name;
             cout << "x y (0-" << MAP_WIDTH-1 << " 0-" << MAP_HEIGHT-1 << "): "; 
             cin >> x >> y;
@@ -108,17 +175,7 @@ int main()
             std::random_device rd;
             std::mt19937 gen(rd());
             
-            for (auto& a : npcs)
-                for (auto& b : npcs)
-                    if (a != b && a->is_alive() && b->is_alive() &&
-                        a->distance_to(*b) <= range)
-                    {
-                        BattleVisitor v(*a, observers, gen);
-                        b->accept(v);
-                    }
-
-            npcs.erase(std::remove_if(npcs.begin(), npcs.end(),
-                [](auto& n){ return !n->is_alive(); }), npcs.end());
+            single_round(npcs, range, dispatcher, gen);
             
             cout << "Бой завершен!" << endl;
         }
@@ -126,6 +183,12 @@ int main()
         {
             run_simulation();
         }
+#ifdef RPG_OUT_OF_CORE
+        else if (choice == 7)
+        {
+            run_out_of_core();
+        }
+#endif
 
     } while (choice != 0);
 
@@ -0,0 +1,615 @@
+#include "out_of_core.h"
+#include <cmath>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <limits>
+#include <filesystem>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+//================ Out-of-core world ========
+RegionStore::RegionStore(const RegionGrid& grid, size_t budget_bytes,
+                         size_t records, const string& parent)
+    : regions(grid),
+      page_capacity(records),
+      page_bytes(records * sizeof(NpcRecord)),
+      budget(budget_bytes),
+      chains(regions.count())
+{
+    if (records == 0 || records % min_page_records() != 0)
+        throw std::runtime_error("Размер страницы района должен быть кратен странице памяти");
+    if (budget < 2 * page_bytes + index_bytes())
+        throw std::runtime_error("Бюджет хранилища меньше двух страниц района");
+
+    // Собственный каталог: второй экземпляр программы не тронет наш файл
+    std::filesystem::path base = parent.empty() ? std::filesystem::current_path()
+                                                : std::filesystem::path(parent);
+    string pattern = (base / "rpg_world_XXXXXX").string();
+    vector<char> buffer(pattern.begin(), pattern.end());
+    buffer.push_back('\0');
+    if (!::mkdtemp(buffer.data()))
+        throw std::runtime_error("Не удалось создать каталог мира: " + string(std::strerror(errno)));
+    dir = buffer.data();
+    path = dir + "/pages.bin";
+
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+    {
+        int error = errno;
+        ::rmdir(dir.c_str());
+        throw std::runtime_error("Не удалось открыть файл страниц: " + string(std::strerror(error)));
+    }
+}
+
+size_t RegionStore::min_page_records()
+{
+    return static_cast<size_t>(::sysconf(_SC_PAGESIZE)) / sizeof(NpcRecord);
+}
+
+RegionStore::~RegionStore()
+{
+    for (int page : lru)
+        ::munmap(file_pages[page].data, page_bytes);
+    ::close(fd);
+    ::unlink(path.c_str());
+    ::rmdir(dir.c_str());
+}
+
+// Узел списка LRU - номер страницы и два указателя
+static const size_t LRU_NODE_BYTES = sizeof(int) + 2 * sizeof(void*);
+
+size_t RegionStore::index_bytes() const
+{
+    return chains.capacity() * sizeof(Chain) + chain_bytes +
+           file_pages.capacity() * sizeof(Page) +
+           free_pages.capacity() * sizeof(int) +
+           lru.size() * LRU_NODE_BYTES;
+}
+
+size_t RegionStore::page_size(int region, size_t page) const
+{
+    uint64_t before = page * page_capacity;
+    return static_cast<size_t>(std::min<uint64_t>(page_capacity, chains[region].count - before));
+}
+
+int RegionStore::allocate_page()
+{
+    if (!free_pages.empty())
+    {
+        int page = free_pages.back();
+        free_pages.pop_back();
+        return page;
+    }
+
+    // Файл растет сразу на целую страницу, чтобы отображение не выходило за его конец
+    int page = static_cast<int>(file_pages.size());
+    if (::ftruncate(fd, static_cast<off_t>((page + 1) * page_bytes)) != 0)
+        throw std::runtime_error("Ошибка расширения файла страниц: " + string(std::strerror(errno)));
+    file_pages.emplace_back();
+    return page;
+}
+
+void RegionStore::write(int page, size_t slot, const NpcRecord* records, size_t n)
+{
+    const char* src = reinterpret_cast<const char*>(records);
+    size_t left = n * sizeof(NpcRecord);
+    off_t offset = static_cast<off_t>(page * page_bytes + slot * sizeof(NpcRecord));
+    while (left > 0)
+    {
+        ssize_t written = ::pwrite(fd, src, left, offset);
+        if (written < 0)
+        {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Ошибка записи файла страниц: " + string(std::strerror(errno)));
+        }
+        src += written;
+        offset += written;
+        left -= static_cast<size_t>(written);
+    }
+}
+
+void RegionStore::append(int region, const NpcRecord* records, size_t n)
+{
+    Chain& chain = chains[region];
+    if (chain.pins > 0)
+        throw std::runtime_error("Дозапись в район с закрепленными страницами");
+
+    // Отображенные страницы видят запись через общий кэш страниц
+    while (n > 0)
+    {
+        size_t slot = static_cast<size_t>(chain.count % page_capacity);
+        if (slot == 0)
+        {
+            size_t capacity = chain.pages.capacity();
+            chain.pages.push_back(allocate_page());
+            chain_bytes += (chain.pages.capacity() - capacity) * sizeof(int);
+            // Выросшие таблицы страниц вытесняют отображенные страницы
+            make_room(0);
+        }
+
+        size_t chunk = std::min(n, page_capacity - slot);
+        write(chain.pages.back(), slot, records, chunk);
+        chain.count += chunk;
+        records += chunk;
+        n -= chunk;
+    }
+    memory_peak = std::max(memory_peak, memory_bytes());
+}
+
+NpcRecord* RegionStore::acquire(int region, size_t page)
+{
+    Chain& chain = chains[region];
+    int id = chain.pages[page];
+    Page& p = file_pages[id];
+
+    if (p.data)
+    {
+        lru.splice(lru.begin(), lru, p.lru_pos);
+    }
+    else
+    {
+        make_room(page_bytes + LRU_NODE_BYTES);
+        void* data = ::mmap(nullptr, page_bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+                            fd, static_cast<off_t>(id * page_bytes));
+        if (data == MAP_FAILED)
+            throw std::runtime_error("Ошибка mmap страницы района: " + string(std::strerror(errno)));
+
+        p.data = static_cast<NpcRecord*>(data);
+        mapped_total += page_bytes;
+        lru.push_front(id);
+        p.lru_pos = lru.begin();
+        memory_peak = std::max(memory_peak, memory_bytes());
+    }
+
+    ++p.pins;
+    ++chain.pins;
+    return p.data;
+}
+
+void RegionStore::release(int region, size_t page)
+{
+    Chain& chain = chains[region];
+    --file_pages[chain.pages[page]].pins;
+    --chain.pins;
+}
+
+void RegionStore::truncate(int region, uint64_t new_count)
+{
+    Chain& chain = chains[region];
+    if (chain.pins > 0)
+        throw std::runtime_error("Усечение района с закрепленными страницами");
+    if (new_count > chain.count)
+        throw std::runtime_error("Усечение не может удлинить район");
+
+    size_t keep = static_cast<size_t>((new_count + page_capacity - 1) / page_capacity);
+    while (chain.pages.size() > keep)
+    {
+        int page = chain.pages.back();
+        chain.pages.pop_back();
+        if (file_pages[page].data) unmap(page);
+        free_pages.push_back(page);
+    }
+    chain.count = new_count;
+    make_room(0);
+}
+
+void RegionStore::make_room(size_t extra)
+{
+    if (index_bytes() + extra > budget)
+        throw std::runtime_error("Таблицы страниц не оставляют места в бюджете памяти");
+
+    // Вытесняем давно не использованные незакрепленные страницы
+    auto it = lru.end();
+    while (memory_bytes() + extra > budget)
+    {
+        while (it != lru.begin() && file_pages[*std::prev(it)].pins > 0)
+            --it;
+        if (it == lru.begin())
+            throw std::runtime_error("Бюджет памяти занят закрепленными страницами");
+        --it;
+        int victim = *it;
+        it = std::next(it);
+        unmap(victim);
+    }
+}
+
+void RegionStore::unmap(int page)
+{
+    Page& p = file_pages[page];
+    ::munmap(p.data, page_bytes);
+    mapped_total -= page_bytes;
+    p.data = nullptr;
+    lru.erase(p.lru_pos);
+}
+
+static int max_move_of(const SpeciesTable& table)
+{
+    int result = 0;
+    for (int s = 0; s < table.count(); ++s)
+        result = std::max(result, table.move_distance(s));
+    return result;
+}
+
+static size_t pending_capacity_of(const OutOfCoreConfig& config)
+{
+    return std::max(config.page_records, config.budget_bytes / 16 / sizeof(NpcRecord));
+}
+
+int OutOfCoreWorld::side_for(uint64_t population)
+{
+    double side = std::ceil(std::sqrt(static_cast<double>(population) / WORLD_DENSITY));
+    return std::max(MAP_WIDTH, static_cast<int>(side));
+}
+
+size_t OutOfCoreWorld::scratch_bytes(const OutOfCoreConfig& config, const SpeciesTable& table)
+{
+    // Поиск пар строит сетку по одной странице записей. Отрезок хода задевает
+    // не больше (ход / ячейка + 2)^2 ячеек; векторы при росте занимают
+    // до двух своих размеров.
+    size_t move = static_cast<size_t>(max_move_of(table));
+    size_t cell = static_cast<size_t>(std::max(GRID_CELL_SIZE, table.max_kill_distance()));
+    size_t cells_per_record = (move / cell + 2) * (move / cell + 2);
+    size_t grid_side = (config.region_size + 2 * move + cell - 1) / cell;
+    size_t per_record = 2 * (cells_per_record * sizeof(int) + sizeof(Sweep) +
+                             sizeof(unsigned) + sizeof(int));
+    return config.page_records * per_record + grid_side * grid_side * sizeof(vector<int>);
+}
+
+size_t OutOfCoreWorld::reserve_bytes(const OutOfCoreConfig& config, const SpeciesTable& table)
+{
+    RegionGrid regions(config.region_size, config.side, config.side);
+    size_t region_count = static_cast<size_t>(regions.count());
+    size_t species = static_cast<size_t>(table.count());
+
+    // Счетчики видов и переселенцев по районам, плотность в статистике
+    size_t per_region = species * sizeof(uint64_t) + sizeof(uint32_t) + sizeof(std::atomic<long>);
+    size_t reserved = scratch_bytes(config, table) +
+                      pending_capacity_of(config) * sizeof(NpcRecord) +
+                      region_count * per_region;
+
+    size_t page_bytes = config.page_records * sizeof(NpcRecord);
+    size_t needed = reserved + 2 * page_bytes + region_count * 2 * sizeof(int);
+    if (config.budget_bytes < needed)
+        throw std::runtime_error("Бюджет памяти слишком мал: нужно не меньше " +
+                                 std::to_string((needed + 1023) / 1024) + " КБ");
+    return reserved;
+}
+
+// Вид в записи занимает 16 бит: больший номер молча обрезался бы
+static shared_ptr<const SpeciesTable> record_species_table()
+{
+    auto table = SpeciesTable::current();
+    long limit = static_cast<long>(std::numeric_limits<decltype(NpcRecord::species)>::max()) + 1;
+    if (table->count() > limit)
+        throw std::runtime_error("Мир вне памяти хранит не больше " + std::to_string(limit) +
+                                 " видов, в таблице " + std::to_string(table->count()));
+    return table;
+}
+
+OutOfCoreWorld::OutOfCoreWorld(const OutOfCoreConfig& config)
+    : table(record_species_table()),
+      world_side(config.side),
+      max_move(max_move_of(*table)),
+      cell_size(std::max(GRID_CELL_SIZE, table->max_kill_distance())),
+      pending_capacity(pending_capacity_of(config)),
+      reserved_bytes(reserve_bytes(config, *table)),
+      store(RegionGrid(config.region_size, config.side, config.side),
+            config.budget_bytes - reserved_bytes, config.page_records, config.parent_directory),
+      stats(store.region_grid()),
+      species_counts(store.region_grid().count() * table->count(), 0),
+      pending_in(store.region_grid().count(), 0),
+      grid(cell_size, config.region_size + 2 * max_move, config.region_size + 2 * max_move)
+{
+    pending.reserve(pending_capacity);
+    sweeps.reserve(config.page_records);
+    candidates.reserve(config.page_records);
+}
+
+void OutOfCoreWorld::enqueue(const NpcRecord& record)
+{
+    if (pending.size() == pending_capacity)
+        flush_pending();
+    ++pending_in[store.region_grid().index(record.x, record.y)];
+    pending.push_back(record);
+}
+
+void OutOfCoreWorld::flush_pending()
+{
+    // Дозапись идет по районам подряд, каждая серия - одним куском
+    const RegionGrid& regions = store.region_grid();
+    std::sort(pending.begin(), pending.end(), [&](const NpcRecord& a, const NpcRecord& b)
+    {
+        return regions.index(a.x, a.y) < regions.index(b.x, b.y);
+    });
+
+    for (size_t i = 0; i < pending.size(); )
+    {
+        int region = regions.index(pending[i].x, pending[i].y);
+        size_t end = i;
+        while (end < pending.size() && regions.index(pending[end].x, pending[end].y) == region)
+            ++end;
+        store.append(region, &pending[i], end - i);
+        pending_in[region] = 0;
+        i = end;
+    }
+    pending.clear();
+}
+
+template <class Keep>
+void OutOfCoreWorld::rewrite(int region, Keep keep)
+{
+    uint64_t n = store.count(region);
+    if (n == 0) return;
+
+    // Сжатие на месте: запись не обгоняет чтение, закреплены не больше двух страниц
+    size_t capacity = store.page_records();
+    size_t pages = store.pages(region);
+    uint64_t kept = 0;
+    size_t out_page = 0;
+    NpcRecord* out = store.acquire(region, out_page);
+    for (size_t page = 0; page < pages; ++page)
+    {
+        NpcRecord* recs = store.acquire(region, page);
+        size_t size = store.page_size(region, page);
+        for (size_t i = 0; i < size; ++i)
+        {
+            NpcRecord rec = recs[i];
+            if (!keep(rec)) continue;
+
+            if (kept / capacity != out_page)
+            {
+                store.release(region, out_page);
+                out_page = static_cast<size_t>(kept / capacity);
+                out = store.acquire(region, out_page);
+            }
+            out[kept % capacity] = rec;
+            ++kept;
+        }
+        store.release(region, page);
+    }
+    store.release(region, out_page);
+
+    if (kept != n)
+        store.truncate(region, kept);
+}
+
+void OutOfCoreWorld::populate(uint64_t count, std::mt19937& gen)
+{
+    std::uniform_int_distribution<int> coord(0, world_side - 1);
+    std::uniform_int_distribution<int> type_dist(0, table->count() - 1);
+
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        NpcRecord rec{};
+        rec.id = next_id++;
+        rec.x = rec.sweep_x = coord(gen);
+        rec.y = rec.sweep_y = coord(gen);
+        rec.species = static_cast<uint16_t>(type_dist(gen));
+        rec.alive = 1;
+        stats.on_spawn(rec.species, rec.x, rec.y);
+        int region = store.region_grid().index(rec.x, rec.y);
+        ++species_counts[region * table->count() + rec.species];
+        enqueue(rec);
+    }
+    flush_pending();
+}
+
+void OutOfCoreWorld::movement_tick(std::mt19937& gen)
+{
+    // У записи один отрезок хода: второй ход до боя затер бы первый
+    if (moved)
+        throw std::runtime_error("Второй ход мира без боя между ходами");
+    moved = true;
+    ++tick;
+
+    const RegionGrid& regions = store.region_grid();
+    int species_count = table->count();
+    for (int r = 0; r < regions.count(); ++r)
+    {
+        // Переселенцев в район дописываем, пока его страницы не закреплены;
+        // пока район обходится, новых переселенцев в него не бывает
+        if (pending_in[r] > 0)
+            flush_pending();
+
+        rewrite(r, [&](NpcRecord& rec)
+        {
+            // Переселенцы из уже пройденных районов второй раз не ходят
+            if (rec.alive && rec.tick != tick)
+            {
+                int step = table->move_distance(rec.species);
+                std::uniform_int_distribution<int> dir_dist(-step, step);
+                int new_x = std::clamp(rec.x + dir_dist(gen), 0, world_side - 1);
+                int new_y = std::clamp(rec.y + dir_dist(gen), 0, world_side - 1);
+                stats.on_move(rec.x, rec.y, new_x, new_y);
+                rec.sweep_x = rec.x;
+                rec.sweep_y = rec.y;
+                rec.x = new_x;
+                rec.y = new_y;
+                rec.tick = tick;
+            }
+
+            int dest = regions.index(rec.x, rec.y);
+            if (dest == r) return true;
+
+            --species_counts[r * species_count + rec.species];
+            ++species_counts[dest * species_count + rec.species];
+            enqueue(rec);
+            return false;
+        });
+    }
+    flush_pending();
+}
+
+bool OutOfCoreWorld::regions_interact(int a, int b) const
+{
+    int n = table->count();
+    const uint64_t* ca = &species_counts[a * n];
+    const uint64_t* cb = &species_counts[b * n];
+
+    for (int sa = 0; sa < n; ++sa)
+    {
+        if (ca[sa] == 0) continue;
+        for (int sb = 0; sb < n; ++sb)
+        {
+            // Внутри одного района бой вида с самим собой требует двоих
+            uint64_t need = (a == b && sa == sb) ? 2 : 1;
+            if (cb[sb] >= need && (table->can_kill(sa, sb) || table->can_kill(sb, sa)))
+                return true;
+        }
+    }
+    return false;
+}
+
+void OutOfCoreWorld::fight_pages(int a_region, NpcRecord* a_recs, size_t na,
+                                 int b_region, NpcRecord* b_recs, size_t nb,
+                                 bool same_page, std::mt19937& gen)
+{
+    int species_count = table->count();
+    std::uniform_int_distribution<int> dice(1, 6);
+    auto attack_wins = [&]
+    {
+        int attack_power = dice(gen);
+        int defense_power = dice(gen);
+        return attack_power > defense_power;
+    };
+
+    // Тот же поиск пар по сетке, что и в BattleEngine; сетка покрывает
+    // район страницы b с запасом на ход
+    const RegionGrid& regions = store.region_grid();
+    grid.set_origin((b_region % regions.cols) * regions.size - max_move,
+                    (b_region / regions.cols) * regions.size - max_move);
+    sweeps.resize(nb);
+    grid.clear();
+    for (size_t j = 0; j < nb; ++j)
+    {
+        const NpcRecord& rec = b_recs[j];
+        if (!rec.alive || !table->can_fight(rec.species)) continue;
+        const Sweep& s = sweeps[j] = Sweep{rec.sweep_x, rec.sweep_y, rec.x, rec.y};
+        grid.insert(static_cast<int>(j), std::min(s.x0, s.x1), std::min(s.y0, s.y1),
+                                         std::max(s.x0, s.x1), std::max(s.y0, s.y1));
+    }
+
+    for (size_t i = 0; i < na; ++i)
+    {
+        NpcRecord& a = a_recs[i];
+        if (!a.alive || !table->can_fight(a.species)) continue;
+
+        Sweep si{a.sweep_x, a.sweep_y, a.x, a.y};
+        int kill_a = table->kill_distance(a.species);
+        grid.query(std::min(si.x0, si.x1) - kill_a, std::min(si.y0, si.y1) - kill_a,
+                   std::max(si.x0, si.x1) + kill_a, std::max(si.y0, si.y1) + kill_a,
+                   candidates);
+        std::sort(candidates.begin(), candidates.end());
+
+        for (int j : candidates)
+        {
+            if (same_page && static_cast<size_t>(j) <= i) continue;
+            NpcRecord& b = b_recs[j];
+            // Пара без правил боя не влияет на исход
+            if (!table->can_kill(a.species, b.species) &&
+                !table->can_kill(b.species, a.species)) continue;
+            if (!b.alive) continue;
+
+            double distance = closest_approach(si, sweeps[j]);
+            if (distance > kill_a || distance > table->kill_distance(b.species)) continue;
+            if (on_engage) on_engage(a, b);
+
+            // a атакует b, затем b атакует a, если оба живы
+            if (table->can_kill(a.species, b.species) && attack_wins())
+            {
+                b.alive = 0;
+                --species_counts[b_region * species_count + b.species];
+                stats.on_kill(a.species, b.species, b.x, b.y);
+            }
+            if (a.alive && b.alive &&
+                table->can_kill(b.species, a.species) && attack_wins())
+            {
+                a.alive = 0;
+                --species_counts[a_region * species_count + a.species];
+                stats.on_kill(b.species, a.species, a.x, a.y);
+            }
+        }
+    }
+}
+
+void OutOfCoreWorld::fight_regions(int a, int b, std::mt19937& gen)
+{
+    // Пары страниц: в одном районе - каждая пара один раз, включая страницу с собой
+    for (size_t pa = 0; pa < store.pages(a); ++pa)
+    {
+        NpcRecord* a_recs = store.acquire(a, pa);
+        size_t na = store.page_size(a, pa);
+        for (size_t pb = (a == b ? pa : 0); pb < store.pages(b); ++pb)
+        {
+            NpcRecord* b_recs = store.acquire(b, pb);
+            fight_pages(a, a_recs, na, b, b_recs, store.page_size(b, pb), a == b && pa == pb, gen);
+            store.release(b, pb);
+        }
+        store.release(a, pa);
+    }
+}
+
+void OutOfCoreWorld::battle_tick(std::mt19937& gen)
+{
+    moved = false;
+
+    // Радиус соседства: за ход пара могла сблизиться, даже если сейчас
+    // стоит дальше, чем на дальность убийства
+    const RegionGrid& regions = store.region_grid();
+    int reach = table->max_kill_distance() + 2 * max_move;
+    int radius = reach / regions.size + 1;
+
+    // Соседи «вперед» по порядку районов: каждая пара районов - ровно один раз
+    vector<std::pair<int, int>> forward;
+    for (int dr = 0; dr <= radius; ++dr)
+        for (int dc = -radius; dc <= radius; ++dc)
+            if (dr > 0 || dc > 0)
+                forward.emplace_back(dr, dc);
+
+    for (int r = 0; r < regions.count(); ++r)
+    {
+        if (store.count(r) == 0) continue;
+
+        // Районы без возможных боев вообще не отображаются
+        if (regions_interact(r, r))
+            fight_regions(r, r, gen);
+
+        int row = r / regions.cols;
+        int col = r % regions.cols;
+        for (auto [dr, dc] : forward)
+        {
+            int nr = row + dr;
+            int nc = col + dc;
+            if (nr >= regions.rows || nc < 0 || nc >= regions.cols) continue;
+            int neighbour = nr * regions.cols + nc;
+            if (store.count(neighbour) == 0 || !regions_interact(r, neighbour)) continue;
+            fight_regions(r, neighbour, gen);
+        }
+
+        // Свой район больше не понадобится в этом тике:
+        // убираем мертвых и начинаем новые отрезки
+        rewrite(r, [](NpcRecord& rec)
+        {
+            rec.sweep_x = rec.x;
+            rec.sweep_y = rec.y;
+            return rec.alive != 0;
+        });
+    }
+
+    stats.end_tick();
+}
+
+void OutOfCoreWorld::for_each(const std::function<void(const NpcRecord&)>& visit)
+{
+    for (int r = 0; r < store.region_grid().count(); ++r)
+        for (size_t page = 0; page < store.pages(r); ++page)
+        {
+            const NpcRecord* recs = store.acquire(r, page);
+            size_t size = store.page_size(r, page);
+            for (size_t i = 0; i < size; ++i)
+                visit(recs[i]);
+            store.release(r, page);
+        }
+}
@@ -0,0 +1,189 @@
+#ifndef OUT_OF_CORE_H
+#define OUT_OF_CORE_H
+
+#include "functions.h"
+
+// Мир вне памяти держит записи NPC в файле страниц, отображаемых через
+// POSIX mmap, поэтому собирается только на POSIX-системах: CMake добавляет
+// out_of_core.cpp и задает RPG_OUT_OF_CORE лишь там.
+
+//================ Out-of-core world ======
+// Компактная запись NPC для хранения на диске (32 байта вместо объекта NPC)
+struct NpcRecord
+{
+    uint64_t id;
+    int32_t x;
+    int32_t y;
+    int32_t sweep_x;  // Начало отрезка перемещения
+    int32_t sweep_y;
+    uint32_t tick;    // Тик последнего перемещения
+    uint16_t species;
+    uint8_t alive;
+    uint8_t reserved;
+};
+
+// Хранилище записей в одном файле страниц, отображаемых в память (POSIX mmap).
+// Страница вмещает фиксированное число записей; район - цепочка страниц,
+// так что плотный район занимает больше страниц, а не одну большую.
+// Отображенные страницы живут в LRU-кэше; вместе с таблицами страниц
+// они не превышают бюджет. Файл лежит в собственном каталоге (mkdtemp)
+// внутри parent; деструктор удаляет и файл, и этот каталог.
+class RegionStore
+{
+public:
+    static const size_t DEFAULT_PAGE_RECORDS = 4096; // 128 КБ, кратно страницам до 64 КБ
+    // Записей в одной странице памяти системы - наименьшая допустимая страница района
+    static size_t min_page_records();
+
+    // page_records * sizeof(NpcRecord) должно быть кратно странице памяти;
+    // пустой parent - текущий каталог
+    RegionStore(const RegionGrid& regions, size_t budget_bytes,
+                size_t page_records = DEFAULT_PAGE_RECORDS, const string& parent = "");
+    ~RegionStore();
+
+    RegionStore(const RegionStore&) = delete;
+    RegionStore& operator=(const RegionStore&) = delete;
+
+    const RegionGrid& region_grid() const { return regions; }
+    const string& directory() const { return dir; }
+    size_t page_records() const { return page_capacity; }
+
+    uint64_t count(int region) const { return chains[region].count; }
+    size_t pages(int region) const { return chains[region].pages.size(); }
+    // Записей на странице page района
+    size_t page_size(int region, size_t page) const;
+
+    void append(int region, const NpcRecord* records, size_t n);
+    // Отображает страницу района и закрепляет ее до release()
+    NpcRecord* acquire(int region, size_t page);
+    void release(int region, size_t page);
+    // Освободившиеся страницы хвоста уходят в список свободных
+    void truncate(int region, uint64_t new_count);
+
+    // Отображенные страницы вместе с таблицами страниц
+    size_t memory_bytes() const { return mapped_total + index_bytes(); }
+    size_t peak_memory_bytes() const { return memory_peak; }
+    size_t mapped_pages() const { return lru.size(); }
+
+private:
+    struct Page
+    {
+        NpcRecord* data = nullptr;
+        int pins = 0;
+        std::list<int>::iterator lru_pos;
+    };
+
+    struct Chain
+    {
+        uint64_t count = 0;
+        vector<int> pages; // Номера страниц файла по порядку записей
+        int pins = 0;
+    };
+
+    RegionGrid regions;
+    size_t page_capacity;
+    size_t page_bytes;
+    size_t budget;
+    string dir;
+    string path;
+    int fd = -1;
+    size_t mapped_total = 0;
+    size_t memory_peak = 0;
+    size_t chain_bytes = 0; // Емкость списков страниц районов
+    vector<Chain> chains;
+    vector<Page> file_pages;
+    vector<int> free_pages;
+    std::list<int> lru; // Отображенные страницы, недавние - в начале
+
+    size_t index_bytes() const;
+    int allocate_page();
+    void make_room(size_t extra); // Вытесняет страницы, пока extra байт не влезут в бюджет
+    void unmap(int page);
+    void write(int page, size_t slot, const NpcRecord* records, size_t n);
+};
+
+// Параметры мира вне памяти
+struct OutOfCoreConfig
+{
+    int side = MAP_WIDTH;          // Сторона квадратного мира
+    int region_size = 320;         // При обычной плотности район - около полстраницы
+    size_t budget_bytes = 64u << 20;
+    size_t page_records = RegionStore::DEFAULT_PAGE_RECORDS;
+    // Где создать каталог с файлом страниц; пусто - текущий каталог.
+    // Не стоит указывать tmpfs (часто это /tmp): его файлы лежат в памяти
+    // и подкачке, и мир «больше памяти» снова займет память.
+    string parent_directory;
+};
+
+// Мир, который хранится в RegionStore и обрабатывается район за районом.
+// Бой идет по парам страниц «район - сосед впереди», так что в памяти
+// одновременно закреплены только две страницы. Сетка, отрезки, буфер
+// переселенцев и счетчики районов рассчитаны на одну страницу и вычитаются
+// из бюджета до того, как остаток отдается хранилищу.
+// Ход и бой строго чередуются: у записи хранится один отрезок хода.
+class OutOfCoreWorld
+{
+public:
+    // Средняя плотность населения (NPC на клетку), под которую подбирается сторона мира
+    static constexpr double WORLD_DENSITY = 0.02;
+    static int side_for(uint64_t population);
+
+    explicit OutOfCoreWorld(const OutOfCoreConfig& config);
+
+    void populate(uint64_t count, std::mt19937& gen);
+    void movement_tick(std::mt19937& gen);
+    void battle_tick(std::mt19937& gen);
+
+    // Вызывается для каждой пары, сблизившейся на дистанцию боя (до бросков кубика)
+    void set_engagement_hook(std::function<void(const NpcRecord&, const NpcRecord&)> hook)
+    {
+        on_engage = std::move(hook);
+    }
+    // Обход всех записей по районам (страницы читаются по одной)
+    void for_each(const std::function<void(const NpcRecord&)>& visit);
+
+    int side() const { return world_side; }
+    const WorldStats& get_stats() const { return stats; }
+    const RegionStore& get_store() const { return store; }
+    // Пик памяти под мир: страницы с таблицами и заранее вычтенные буферы
+    size_t peak_bytes() const { return store.peak_memory_bytes() + reserved_bytes; }
+
+private:
+    shared_ptr<const SpeciesTable> table;
+    int world_side;
+    int max_move;
+    int cell_size;
+    size_t pending_capacity;
+    size_t reserved_bytes; // Буферы, вычтенные из бюджета хранилища
+    RegionStore store;
+    WorldStats stats;
+    vector<uint64_t> species_counts; // [район * видов + вид], без чтения страниц
+    vector<NpcRecord> pending;       // Переселенцы, фиксированная емкость
+    vector<uint32_t> pending_in;     // Сколько переселенцев ждут каждый район
+    uint32_t tick = 0;
+    bool moved = false;              // Был ход после последнего боя
+    uint64_t next_id = 0;
+
+    SpatialGrid grid;
+    vector<Sweep> sweeps;
+    vector<int> candidates;
+    std::function<void(const NpcRecord&, const NpcRecord&)> on_engage;
+
+    static size_t scratch_bytes(const OutOfCoreConfig& config, const SpeciesTable& table);
+    static size_t reserve_bytes(const OutOfCoreConfig& config, const SpeciesTable& table);
+
+    // Может ли хоть одна пара видов из районов a и b сразиться
+    bool regions_interact(int a, int b) const;
+    // Бои между записями двух страниц (или одной и той же)
+    void fight_pages(int a_region, NpcRecord* a_recs, size_t na,
+                     int b_region, NpcRecord* b_recs, size_t nb,
+                     bool same_page, std::mt19937& gen);
+    void fight_regions(int a, int b, std::mt19937& gen);
+    // Сжимает район на месте, оставляя записи, для которых keep вернул true
+    template <class Keep>
+    void rewrite(int region, Keep keep);
+    void enqueue(const NpcRecord& record);
+    void flush_pending();
+};
+
+#endif
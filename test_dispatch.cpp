@@ -0,0 +1,205 @@
+#include "test_helpers.h"
+#include <algorithm>
+
+using std::make_shared;
+
+// Проверка фильтров KillDispatcher: границы области, виды, «любой вид»,
+// выборка каждого N-го события и порядок доставки в одном списке.
+// Случайные подписки сверяются с прямой проверкой фильтра.
+
+// Событие убийства жертвы вида victim в точке (x, y)
+static void kill_at(KillDispatcher& d, int killer, int victim, int x, int y)
+{
+    NPC k(killer, "K", 0, 0);
+    NPC v(victim, "V", x, y);
+    d.dispatch(k, v);
+}
+
+static void test_bbox_edges()
+{
+    KillDispatcher d;
+    auto obs = make_shared<CountingObserver>();
+    KillFilter f;
+    f.min_x = 10; f.max_x = 30; // Область пересекает границу районов
+    f.min_y = 20; f.max_y = 40;
+    d.subscribe(obs, f);
+
+    // Границы включительно
+    kill_at(d, 0, 1, 10, 20);
+    kill_at(d, 0, 1, 30, 40);
+    kill_at(d, 0, 1, 10, 40);
+    kill_at(d, 0, 1, 30, 20);
+    expect(obs->count == 4, "углы области должны входить в фильтр");
+
+    kill_at(d, 0, 1, 9, 20);
+    kill_at(d, 0, 1, 31, 40);
+    kill_at(d, 0, 1, 10, 19);
+    kill_at(d, 0, 1, 30, 41);
+    expect(obs->count == 4, "точки за границей области не должны доставляться");
+
+    // Внутри области по обе стороны границы районов - ровно по одной доставке
+    kill_at(d, 0, 1, 24, 30);
+    kill_at(d, 0, 1, 25, 30);
+    expect(obs->count == 6, "событие внутри области доставляется один раз");
+}
+
+static void test_species()
+{
+    KillDispatcher d;
+    auto exact = make_shared<CountingObserver>();
+    auto by_killer = make_shared<CountingObserver>();
+    auto by_victim = make_shared<CountingObserver>();
+    auto any = make_shared<CountingObserver>();
+
+    KillFilter f;
+    f.killer_species = 0; f.victim_species = 1;
+    d.subscribe(exact, f);
+    f.killer_species = 0; f.victim_species = -1;
+    d.subscribe(by_killer, f);
+    f.killer_species = -1; f.victim_species = 1;
+    d.subscribe(by_victim, f);
+    d.subscribe(any);
+
+    kill_at(d, 0, 1, 50, 50);
+    kill_at(d, 0, 0, 50, 50);
+    kill_at(d, 1, 1, 50, 50);
+    kill_at(d, 1, 0, 50, 50);
+
+    expect(exact->count == 1, "точный фильтр видов");
+    expect(by_killer->count == 2, "фильтр только по убийце");
+    expect(by_victim->count == 2, "фильтр только по жертве");
+    expect(any->count == 4, "подписка без фильтра видов");
+
+    bool rejected = false;
+    try
+    {
+        f.killer_species = SpeciesTable::current()->count();
+        d.subscribe(any, f);
+    }
+    catch (const std::runtime_error&)
+    {
+        rejected = true;
+    }
+    expect(rejected, "неизвестный вид в фильтре должен отклоняться");
+}
+
+static void test_sample_every()
+{
+    KillDispatcher d;
+    auto every_third = make_shared<CountingObserver>();
+    auto other_victims = make_shared<CountingObserver>();
+    KillFilter f;
+    f.sample_every = 3;
+    f.victim_species = 1;
+    d.subscribe(every_third, f);
+    f.victim_species = 0;
+    d.subscribe(other_victims, f);
+
+    // Неподходящие события не сдвигают счетчик выборки
+    for (int i = 0; i < 9; ++i)
+    {
+        kill_at(d, 0, 1, 50, 50);
+        kill_at(d, 0, 2, 50, 50);
+    }
+    expect(every_third->count == 3, "доставляется каждое третье подходящее событие");
+    expect(other_victims->count == 0, "чужие события не доставляются");
+
+    kill_at(d, 0, 1, 50, 50);
+    expect(every_third->count == 4, "первое событие каждой тройки доставляется");
+}
+
+static void test_order()
+{
+    // Подписчики одного списка получают событие в порядке подписки,
+    // и каждый подписчик - ровно один раз
+    KillDispatcher d;
+    vector<int> log;
+    KillFilter local;
+    local.min_x = 40; local.max_x = 60;
+    local.min_y = 40; local.max_y = 60;
+    KillFilter typed;
+    typed.killer_species = 0;
+
+    d.subscribe(make_shared<CountingObserver>(0, &log));
+    d.subscribe(make_shared<CountingObserver>(1, &log), typed);
+    d.subscribe(make_shared<CountingObserver>(2, &log));
+    d.subscribe(make_shared<CountingObserver>(3, &log), local);
+    d.subscribe(make_shared<CountingObserver>(4, &log));
+
+    kill_at(d, 0, 1, 50, 50);
+    vector<int> everywhere;
+    for (int id : log)
+        if (id % 2 == 0) everywhere.push_back(id);
+    expect(everywhere == vector<int>({0, 2, 4}), "подписчики одного списка - в порядке подписки");
+    std::sort(log.begin(), log.end());
+    expect(log == vector<int>({0, 1, 2, 3, 4}), "каждый подписчик получает событие один раз");
+}
+
+static void test_random_against_filter()
+{
+    const int OBSERVERS = 300;
+    const int EVENTS = 20000;
+    int species = SpeciesTable::current()->count();
+
+    std::mt19937 gen(7);
+    auto roll = [&](int lo, int hi) { return std::uniform_int_distribution<int>(lo, hi)(gen); };
+
+    KillDispatcher d;
+    vector<KillFilter> filters;
+    vector<shared_ptr<CountingObserver>> observers;
+    for (int i = 0; i < OBSERVERS; ++i)
+    {
+        KillFilter f;
+        if (roll(0, 3))
+        {
+            f.min_x = roll(-5, MAP_WIDTH);
+            f.min_y = roll(-5, MAP_HEIGHT);
+            f.max_x = f.min_x + roll(0, 60);
+            f.max_y = f.min_y + roll(0, 60);
+        }
+        f.killer_species = roll(-1, species - 1);
+        f.victim_species = roll(-1, species - 1);
+        f.sample_every = roll(0, 1) ? 1 : roll(0, 5);
+        filters.push_back(f);
+        observers.push_back(make_shared<CountingObserver>());
+        d.subscribe(observers.back(), f);
+    }
+
+    // Прямая проверка каждого фильтра на каждом событии
+    vector<long> matched(OBSERVERS, 0);
+    vector<long> expected(OBSERVERS, 0);
+    for (int e = 0; e < EVENTS; ++e)
+    {
+        int k = roll(0, species - 1);
+        int v = roll(0, species - 1);
+        int x = roll(0, MAP_WIDTH - 1);
+        int y = roll(0, MAP_HEIGHT - 1);
+        kill_at(d, k, v, x, y);
+
+        for (int i = 0; i < OBSERVERS; ++i)
+        {
+            const KillFilter& f = filters[i];
+            if (x < f.min_x || x > f.max_x || y < f.min_y || y > f.max_y) continue;
+            if (f.killer_species >= 0 && f.killer_species != k) continue;
+            if (f.victim_species >= 0 && f.victim_species != v) continue;
+            if (matched[i]++ % std::max(1, f.sample_every) == 0) ++expected[i];
+        }
+    }
+
+    int wrong = 0;
+    for (int i = 0; i < OBSERVERS; ++i)
+        if (observers[i]->count != expected[i]) ++wrong;
+    expect(wrong == 0, "случайные подписки: " + std::to_string(wrong) +
+                       " наблюдателей получили не то число событий");
+}
+
+int main()
+{
+    test_bbox_edges();
+    test_species();
+    test_sample_every();
+    test_order();
+    test_random_against_filter();
+
+    return test_result("Фильтры рассылки работают");
+}
@@ -0,0 +1,52 @@
+#ifndef TEST_HELPERS_H
+#define TEST_HELPERS_H
+
+#include "functions.h"
+#include <iostream>
+
+// Общее для проверочных программ и замеров: счетчик проваленных проверок
+// с итоговым кодом возврата для ctest и наблюдатель-счетчик событий.
+
+inline int test_failures = 0;
+
+inline void expect(bool condition, const string& what)
+{
+    if (!condition)
+    {
+        std::cout << "Ошибка: " << what << std::endl;
+        ++test_failures;
+    }
+}
+
+// Печатает итог и возвращает код выхода программы
+inline int test_result(const string& success)
+{
+    if (test_failures)
+    {
+        std::cout << "Провалено проверок: " << test_failures << std::endl;
+        return 1;
+    }
+    std::cout << success << std::endl;
+    return 0;
+}
+
+// Считает доставленные события; с журналом еще и пишет туда свой номер
+class CountingObserver : public Observer
+{
+public:
+    CountingObserver(int id = 0, vector<int>* log = nullptr) : id(id), log(log) {}
+
+    void on_kill(const string&, const string&) override
+    {
+        ++count;
+        if (log) log->push_back(id);
+    }
+
+    long count = 0;
+
+private:
+    int id;
+    vector<int>* log;
+};
+
+#endif
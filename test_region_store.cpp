@@ -0,0 +1,205 @@
+#include "test_helpers.h"
+#include "out_of_core.h"
+#include <filesystem>
+
+// Проверка RegionStore: цепочки страниц, закрепление, вытеснение LRU
+// в пределах бюджета, усечение с повторным использованием страниц
+// и уборка временного каталога.
+
+// Самая мелкая страница района, какую допускает система (4 КБ и больше)
+const size_t PAGE = RegionStore::min_page_records();
+const size_t PAGE_BYTES = PAGE * sizeof(NpcRecord);
+const size_t BUDGET = 4 * PAGE_BYTES + 4096;  // Четыре страницы и таблицы
+const RegionGrid REGIONS(50, 100, 100);       // Четыре района
+const uint64_t REGION_IDS = 1000000;          // Номера записей района r начинаются с r * REGION_IDS
+
+static vector<NpcRecord> make_records(uint64_t first, size_t n)
+{
+    vector<NpcRecord> records(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        records[i] = NpcRecord{};
+        records[i].id = first + i;
+        records[i].alive = 1;
+    }
+    return records;
+}
+
+// Сверяет записи района с ожидаемыми номерами first, first + 1, ...
+static bool region_holds(RegionStore& store, int region, uint64_t first, uint64_t n)
+{
+    if (store.count(region) != n) return false;
+    uint64_t expected = first;
+    for (size_t page = 0; page < store.pages(region); ++page)
+    {
+        const NpcRecord* recs = store.acquire(region, page);
+        size_t size = store.page_size(region, page);
+        bool ok = true;
+        for (size_t i = 0; i < size; ++i)
+            ok = ok && recs[i].id == expected++;
+        store.release(region, page);
+        if (!ok) return false;
+    }
+    return expected == first + n;
+}
+
+template <class Action>
+static bool throws(Action action)
+{
+    try
+    {
+        action();
+    }
+    catch (const std::runtime_error&)
+    {
+        return true;
+    }
+    return false;
+}
+
+static void test_pages_and_eviction()
+{
+    RegionStore store(REGIONS, BUDGET, PAGE);
+
+    // Район длиннее страницы уходит в цепочку страниц
+    const size_t total = 2 * PAGE + PAGE / 3;
+    auto records = make_records(0, total);
+    store.append(0, records.data(), PAGE / 2);
+    store.append(0, records.data() + PAGE / 2, total - PAGE / 2);
+    expect(store.pages(0) == 3, "район из двух с лишним страниц должен занять три страницы");
+    expect(store.page_size(0, 2) == PAGE / 3, "неполная последняя страница");
+    expect(region_holds(store, 0, 0, total), "записи района после дозаписи");
+
+    for (int r = 1; r < REGIONS.count(); ++r)
+    {
+        auto more = make_records(REGION_IDS * r, 2 * PAGE);
+        store.append(r, more.data(), more.size());
+    }
+
+    // Обход всех девяти страниц не выходит за бюджет
+    for (int round = 0; round < 3; ++round)
+        for (int r = 0; r < REGIONS.count(); ++r)
+            for (size_t page = 0; page < store.pages(r); ++page)
+            {
+                store.acquire(r, page);
+                store.release(r, page);
+                expect(store.mapped_pages() <= 4, "отображено больше страниц, чем позволяет бюджет");
+                expect(store.memory_bytes() <= BUDGET, "память хранилища превысила бюджет");
+            }
+    expect(store.peak_memory_bytes() <= BUDGET, "пик памяти хранилища выше бюджета");
+
+    // Изменение через отображение переживает вытеснение страницы
+    NpcRecord* first = store.acquire(0, 0);
+    first[5].alive = 0;
+    store.release(0, 0);
+    for (int r = 1; r < REGIONS.count(); ++r)
+        for (size_t page = 0; page < store.pages(r); ++page)
+        {
+            store.acquire(r, page);
+            store.release(r, page);
+        }
+    first = store.acquire(0, 0);
+    expect(first[5].alive == 0 && first[5].id == 5, "изменение записи потеряно при вытеснении");
+    first[5].alive = 1;
+    store.release(0, 0);
+    expect(region_holds(store, 1, REGION_IDS, 2 * PAGE), "записи района после вытеснений");
+}
+
+static void test_pinning()
+{
+    RegionStore store(REGIONS, BUDGET, PAGE);
+    for (int r = 0; r < REGIONS.count(); ++r)
+    {
+        auto records = make_records(REGION_IDS * r, 2 * PAGE);
+        store.append(r, records.data(), records.size());
+    }
+
+    // Четыре закрепленные страницы занимают весь бюджет
+    const NpcRecord* pinned[4];
+    for (int r = 0; r < 4; ++r)
+        pinned[r] = store.acquire(r, 0);
+    expect(throws([&] { store.acquire(0, 1); }),
+           "закрепленные страницы не должны вытесняться");
+    for (int r = 0; r < 4; ++r)
+        expect(pinned[r][0].id == REGION_IDS * r, "закрепленная страница испорчена");
+
+    auto extra = make_records(0, 1);
+    expect(throws([&] { store.append(0, extra.data(), 1); }), "дозапись в закрепленный район");
+    expect(throws([&] { store.truncate(0, 0); }), "усечение закрепленного района");
+
+    // Повторное закрепление той же страницы и освобождение по одному
+    store.acquire(1, 0);
+    store.release(1, 0);
+    for (int r = 0; r < 4; ++r)
+        store.release(r, 0);
+    store.acquire(0, 1);
+    store.release(0, 1);
+    store.append(0, extra.data(), 1);
+    expect(store.count(0) == 2 * PAGE + 1, "дозапись после снятия закрепления");
+}
+
+static void test_truncate_reuses_pages()
+{
+    RegionStore store(REGIONS, BUDGET, PAGE);
+    auto records = make_records(0, 3 * PAGE);
+    store.append(0, records.data(), records.size());
+    std::filesystem::path file = std::filesystem::path(store.directory()) / "pages.bin";
+    auto size = std::filesystem::file_size(file);
+    expect(size == 3 * PAGE_BYTES, "файл должен расти страницами");
+
+    store.truncate(0, PAGE + 10);
+    expect(store.pages(0) == 2 && region_holds(store, 0, 0, PAGE + 10), "усечение до части страницы");
+    store.truncate(0, 0);
+    expect(store.pages(0) == 0 && store.count(0) == 0, "усечение до пустого района");
+
+    // Освобожденные страницы используются снова, файл не растет
+    auto more = make_records(500, 3 * PAGE);
+    store.append(2, more.data(), more.size());
+    expect(std::filesystem::file_size(file) == size, "освобожденные страницы не переиспользованы");
+    expect(region_holds(store, 2, 500, 3 * PAGE), "записи на переиспользованных страницах");
+    expect(throws([&] { store.truncate(2, 3 * PAGE + 1); }), "усечение не удлиняет район");
+}
+
+static void test_directories()
+{
+    string first_dir;
+    {
+        RegionStore a(REGIONS, BUDGET, PAGE);
+        RegionStore b(REGIONS, BUDGET, PAGE);
+        first_dir = a.directory();
+        expect(a.directory() != b.directory(), "два хранилища делят каталог");
+        expect(std::filesystem::is_directory(first_dir), "каталог хранилища не создан");
+    }
+    expect(!std::filesystem::exists(first_dir), "каталог хранилища не удален");
+    expect(std::filesystem::equivalent(std::filesystem::path(first_dir).parent_path(),
+                                       std::filesystem::current_path()),
+           "по умолчанию каталог создается в текущем каталоге");
+
+    std::filesystem::path parent = std::filesystem::temp_directory_path();
+    {
+        RegionStore store(REGIONS, BUDGET, PAGE, parent.string());
+        expect(std::filesystem::equivalent(std::filesystem::path(store.directory()).parent_path(), parent),
+               "каталог хранилища создается в заданном каталоге");
+    }
+
+    expect(throws([] { RegionStore store(REGIONS, BUDGET, 100); }),
+           "страница не кратна странице памяти");
+    expect(throws([] { RegionStore store(REGIONS, PAGE_BYTES, PAGE); }),
+           "бюджет меньше двух страниц");
+}
+
+int main()
+{
+    try
+    {
+        test_pages_and_eviction();
+        test_pinning();
+        test_truncate_reuses_pages();
+        test_directories();
+    }
+    catch (const std::exception& e)
+    {
+        expect(false, string("исключение: ") + e.what());
+    }
+    return test_result("Хранилище районов работает");
+}
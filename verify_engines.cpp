@@ -0,0 +1,535 @@
+#include "functions.h"
+#ifdef RPG_OUT_OF_CORE
+#include "out_of_core.h"
+#endif
+#include <iostream>
+#include <sstream>
+
+using std::cout;
+using std::endl;
+using std::make_shared;
+
+// Проверочный стенд: эталонные и быстрые движки запускаются из одного зерна
+// на одинаковых NPC, события убийств и позиции сравниваются по тикам.
+// Запуск: verify_engines [число сценариев] [первое зерно]
+
+struct NpcSpec
+{
+    int species;
+    int x;
+    int y;
+};
+
+struct Scenario
+{
+    unsigned seed;
+    string rules;
+    vector<NpcSpec> npcs;
+    int ticks;
+    int moves_per_battle;
+    double range; // Дальность одиночного раунда из меню
+};
+
+// Все, что сравнивается между движками
+struct Trace
+{
+    vector<vector<string>> kills; // События по тикам
+    vector<string> final_state;   // Позиции выживших и счетчики статистики
+};
+
+class RecordingObserver : public Observer
+{
+public:
+    void on_kill(const string& killer, const string& victim) override
+    {
+        events.push_back(killer + " -> " + victim);
+    }
+
+    vector<string> take()
+    {
+        vector<string> result;
+        result.swap(events);
+        return result;
+    }
+
+private:
+    vector<string> events;
+};
+
+static vector<shared_ptr<NPC>> make_npcs(const Scenario& scn)
+{
+    vector<shared_ptr<NPC>> npcs;
+    for (size_t i = 0; i < scn.npcs.size(); ++i)
+    {
+        const NpcSpec& spec = scn.npcs[i];
+        npcs.push_back(make_shared<NPC>(spec.species, "N" + std::to_string(i), spec.x, spec.y));
+    }
+    return npcs;
+}
+
+static void record_final(Trace& trace, const vector<shared_ptr<NPC>>& npcs, const WorldStats* stats)
+{
+    for (auto& npc : npcs)
+    {
+        auto [x, y] = npc->get_position();
+        trace.final_state.push_back(npc->get_name() + " " + std::to_string(x) + " " +
+                                    std::to_string(y) + (npc->is_alive() ? "" : " dead"));
+    }
+
+    if (stats)
+    {
+        const SpeciesTable& table = stats->species_table();
+        for (int s = 0; s < table.count(); ++s)
+            trace.final_state.push_back("alive " + table.name(s) + " " + std::to_string(stats->alive(s)));
+    }
+}
+
+static Trace run_battle(const Scenario& scn, bool optimized)
+{
+    auto npcs = make_npcs(scn);
+    auto recorder = make_shared<RecordingObserver>();
+    KillDispatcher dispatcher;
+    dispatcher.subscribe(recorder);
+    WorldStats stats;
+    ActiveRegions regions;
+    for (auto& npc : npcs)
+    {
+        auto [x, y] = npc->get_position();
+        stats.on_spawn(npc->species(), x, y);
+        regions.add(*npc);
+    }
+
+    std::mt19937 gen(scn.seed);
+    BattleEngine engine;
+    Trace trace;
+
+    for (int t = 0; t < scn.ticks; ++t)
+    {
+        // Быстрый движок работает только по бодрствующим районам
+        for (int m = 0; m < scn.moves_per_battle; ++m)
+            movement_tick(npcs, gen, &stats, optimized ? &regions : nullptr);
+
+        if (optimized)
+            engine.tick(npcs, dispatcher, gen, &stats, &regions);
+        else
+            battle_tick_reference(npcs, dispatcher, gen, &stats);
+
+        trace.kills.push_back(recorder->take());
+    }
+
+    record_final(trace, npcs, &stats);
+    return trace;
+}
+
+static Trace run_round(const Scenario& scn, bool optimized)
+{
+    auto npcs = make_npcs(scn);
+    auto recorder = make_shared<RecordingObserver>();
+    KillDispatcher dispatcher;
+    dispatcher.subscribe(recorder);
+
+    std::mt19937 gen(scn.seed);
+    if (optimized)
+        single_round(npcs, scn.range, dispatcher, gen);
+    else
+        single_round_reference(npcs, scn.range, dispatcher, gen);
+
+    Trace trace;
+    trace.kills.push_back(recorder->take());
+    record_final(trace, npcs, nullptr);
+    return trace;
+}
+
+// Описание первого расхождения или пустая строка
+static string diff(const Trace& expected, const Trace& actual)
+{
+    std::ostringstream out;
+    for (size_t t = 0; t < std::max(expected.kills.size(), actual.kills.size()); ++t)
+    {
+        if (t >= expected.kills.size() || t >= actual.kills.size() ||
+            expected.kills[t] != actual.kills[t])
+        {
+            out << "тик " << t + 1 << ": убийства различаются\n  эталон:";
+            if (t < expected.kills.size())
+                for (auto& e : expected.kills[t]) out << " [" << e << "]";
+            out << "\n  быстрый:";
+            if (t < actual.kills.size())
+                for (auto& e : actual.kills[t]) out << " [" << e << "]";
+            return out.str();
+        }
+    }
+
+    if (expected.final_state != actual.final_state)
+    {
+        out << "итоговое состояние различается\n  эталон:";
+        for (auto& e : expected.final_state) out << " [" << e << "]";
+        out << "\n  быстрый:";
+        for (auto& e : actual.final_state) out << " [" << e << "]";
+        return out.str();
+    }
+    return "";
+}
+
+// Делает правила сценария текущими; прошлый сценарий к этому моменту
+// уничтожил все NPC и движки, так что таблица свободна
+static void install_rules(const string& text)
+{
+    std::istringstream rules(text);
+    SpeciesTable::install(SpeciesTable::parse(rules));
+}
+
+static string check(const Scenario& scn)
+{
+    install_rules(scn.rules);
+
+    string report = diff(run_battle(scn, false), run_battle(scn, true));
+    if (!report.empty()) return "battle_tick: " + report;
+
+    report = diff(run_round(scn, false), run_round(scn, true));
+    if (!report.empty()) return "single_round: " + report;
+
+    return "";
+}
+
+// Орк уходит на 20 клеток и возвращается за два хода одного шага боя,
+// медведь стоит в 5 клетках от точки разворота. Прямой отрезок от начала
+// до конца пути нулевой, бой должен находиться по отдельным ходам.
+static string check_turnaround()
+{
+    install_rules(SpeciesTable::default_config());
+    auto table = SpeciesTable::current();
+
+    for (bool optimized : {false, true})
+    {
+        bool engaged = false;
+        // Кубик может не дать убийства, поэтому перебираем зерна
+        for (unsigned seed = 1; seed <= 20 && !engaged; ++seed)
+        {
+            vector<shared_ptr<NPC>> npcs = {
+                make_shared<NPC>(table->find("Orc"), "Orc", 40, 50),
+                make_shared<NPC>(table->find("Bear"), "Bear", 60, 55)};
+            ActiveRegions regions;
+            for (auto& npc : npcs) regions.add(*npc);
+
+            npcs[0]->move(20, 0);
+            npcs[1]->move(0, 0);
+            npcs[0]->move(-20, 0);
+            npcs[1]->move(0, 0);
+            for (auto& npc : npcs) regions.update(*npc);
+
+            auto recorder = make_shared<RecordingObserver>();
+            KillDispatcher dispatcher;
+            dispatcher.subscribe(recorder);
+            std::mt19937 gen(seed);
+            BattleEngine engine;
+            if (optimized)
+                engine.tick(npcs, dispatcher, gen, nullptr, &regions);
+            else
+                battle_tick_reference(npcs, dispatcher, gen);
+            engaged = !recorder->take().empty();
+        }
+
+        if (!engaged)
+            return string(optimized ? "быстрый" : "эталонный") +
+                   " движок пропустил бой на развороте орка";
+    }
+    return "";
+}
+
+#ifdef RPG_OUT_OF_CORE
+// Мир вне памяти бросает кубики в своем порядке, поэтому с эталоном
+// сверяются не убийства, а пары боя: каждый бой допустим и случается
+// один раз, а каждая допустимая пара, пережившая тик, сразилась. Пары
+// ищутся прямым перебором по снимку мира перед боем. Заодно проверяются
+// ходы, счетчики статистики и бюджет памяти на тесной странице.
+static string check_out_of_core(unsigned seed, const string& rules)
+{
+    install_rules(rules);
+    auto table = SpeciesTable::current();
+    std::mt19937 g(seed);
+    auto roll = [&](int lo, int hi) { return std::uniform_int_distribution<int>(lo, hi)(g); };
+
+    OutOfCoreConfig config;
+    config.side = roll(120, 300);
+    config.region_size = roll(20, 80);
+    // Самая мелкая страница, какую допускает система, и бюджет в пару десятков
+    // страниц: районы занимают по несколько страниц и вытесняются
+    config.page_records = RegionStore::min_page_records();
+    config.budget_bytes = static_cast<size_t>(roll(24, 48)) * config.page_records * sizeof(NpcRecord);
+    OutOfCoreWorld world(config);
+    long population = roll(500, 4000);
+    world.populate(static_cast<uint64_t>(population), g);
+
+    vector<NpcRecord> before;
+    vector<NpcRecord> after;
+    auto snapshot = [&](vector<NpcRecord>& out)
+    {
+        out.clear();
+        world.for_each([&](const NpcRecord& rec) { out.push_back(rec); });
+        std::sort(out.begin(), out.end(),
+                  [](const NpcRecord& a, const NpcRecord& b) { return a.id < b.id; });
+    };
+    snapshot(after);
+
+    int ticks = roll(1, 4);
+    for (int t = 0; t < ticks; ++t)
+    {
+        world.movement_tick(g);
+        snapshot(before);
+        if (before.size() != after.size())
+            return "ход потерял или размножил NPC";
+        for (size_t i = 0; i < before.size(); ++i)
+        {
+            const NpcRecord& rec = before[i];
+            int step = table->move_distance(rec.species);
+            if (rec.id != after[i].id || rec.sweep_x != after[i].x || rec.sweep_y != after[i].y)
+                return "отрезок хода NPC " + std::to_string(rec.id) + " начат не с его позиции";
+            if (std::abs(rec.x - rec.sweep_x) > step || std::abs(rec.y - rec.sweep_y) > step ||
+                rec.x < 0 || rec.y < 0 || rec.x >= world.side() || rec.y >= world.side())
+                return "недопустимый ход NPC " + std::to_string(rec.id);
+        }
+
+        vector<std::pair<uint64_t, uint64_t>> engaged;
+        world.set_engagement_hook([&](const NpcRecord& a, const NpcRecord& b)
+        {
+            engaged.emplace_back(std::min(a.id, b.id), std::max(a.id, b.id));
+        });
+        world.battle_tick(g);
+        world.set_engagement_hook(nullptr);
+        snapshot(after);
+
+        std::sort(engaged.begin(), engaged.end());
+        if (std::adjacent_find(engaged.begin(), engaged.end()) != engaged.end())
+            return "пара сразилась дважды за тик";
+
+        // Допустимые пары прямым перебором, отсеченные только по оси x
+        auto sweep_of = [](const NpcRecord& r) { return Sweep{r.sweep_x, r.sweep_y, r.x, r.y}; };
+        vector<size_t> order(before.size());
+        for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+        auto min_x = [&](size_t i) { return std::min(before[i].x, before[i].sweep_x); };
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return min_x(a) < min_x(b); });
+
+        vector<std::pair<uint64_t, uint64_t>> valid;
+        vector<std::pair<uint64_t, uint64_t>> must_engage;
+        auto survived = [&](uint64_t id)
+        {
+            return std::binary_search(after.begin(), after.end(), NpcRecord{id, 0, 0, 0, 0, 0, 0, 0, 0},
+                                      [](const NpcRecord& a, const NpcRecord& b) { return a.id < b.id; });
+        };
+        int reach = table->max_kill_distance();
+        for (size_t oi = 0; oi < order.size(); ++oi)
+        {
+            const NpcRecord& a = before[order[oi]];
+            int a_max_x = std::max(a.x, a.sweep_x);
+            for (size_t oj = oi + 1; oj < order.size() && min_x(order[oj]) <= a_max_x + reach; ++oj)
+            {
+                const NpcRecord& b = before[order[oj]];
+                if (!table->can_kill(a.species, b.species) && !table->can_kill(b.species, a.species))
+                    continue;
+                double distance = closest_approach(sweep_of(a), sweep_of(b));
+                if (distance > table->kill_distance(a.species) ||
+                    distance > table->kill_distance(b.species)) continue;
+                valid.emplace_back(std::min(a.id, b.id), std::max(a.id, b.id));
+                if (survived(a.id) && survived(b.id))
+                    must_engage.push_back(valid.back());
+            }
+        }
+        std::sort(valid.begin(), valid.end());
+        std::sort(must_engage.begin(), must_engage.end());
+        if (!std::includes(valid.begin(), valid.end(), engaged.begin(), engaged.end()))
+            return "бой между NPC, которые не могли встретиться";
+        if (!std::includes(engaged.begin(), engaged.end(), must_engage.begin(), must_engage.end()))
+            return "пропущен бой пары, пережившей тик";
+    }
+
+    // Статистика сходится с живыми записями хранилища
+    const WorldStats& stats = world.get_stats();
+    vector<long> alive(table->count(), 0);
+    for (const NpcRecord& rec : after)
+    {
+        if (!rec.alive) return "мертвая запись пережила бой";
+        ++alive[rec.species];
+    }
+    long kills = 0;
+    for (int s = 0; s < table->count(); ++s)
+    {
+        if (stats.alive(s) != alive[s]) return "статистика вида " + table->name(s) + " разошлась с миром";
+        for (int v = 0; v < table->count(); ++v)
+            kills += stats.kills(s, v);
+    }
+    if (stats.alive_total() != static_cast<long>(after.size()))
+        return "число живых в статистике разошлось с миром";
+    if (population - stats.alive_total() != kills)
+        return "число погибших не равно числу убийств";
+
+    long density = 0;
+    const RegionGrid& regions = stats.region_grid();
+    for (int row = 0; row < regions.rows; ++row)
+        for (int col = 0; col < regions.cols; ++col)
+            density += stats.density(col, row);
+    if (density != stats.alive_total())
+        return "плотность по районам не сходится с числом живых";
+
+    if (world.peak_bytes() > config.budget_bytes)
+        return "пик памяти " + std::to_string(world.peak_bytes()) + " выше бюджета " +
+               std::to_string(config.budget_bytes);
+    return "";
+}
+#endif
+
+static Scenario generate(unsigned seed)
+{
+    std::mt19937 g(seed);
+    auto roll = [&](int lo, int hi) { return std::uniform_int_distribution<int>(lo, hi)(g); };
+
+    Scenario scn;
+    scn.seed = seed;
+
+    // Половина сценариев - со случайными видами и правилами боя
+    int species = 3;
+    if (roll(0, 1))
+    {
+        scn.rules = SpeciesTable::default_config();
+    }
+    else
+    {
+        species = roll(1, 6);
+        std::ostringstream rules;
+        for (int s = 0; s < species; ++s)
+            rules << "species S" << s << " " << roll(0, 25) << " " << roll(0, 15) << "\n";
+        for (int a = 0; a < species; ++a)
+            for (int v = 0; v < species; ++v)
+                if (roll(0, 99) < 35)
+                    rules << "eats S" << a << " S" << v << "\n";
+        scn.rules = rules.str();
+    }
+
+    // Равномерно по карте или плотной кучей, чтобы боев было много
+    int count = roll(0, 40);
+    bool clustered = roll(0, 1);
+    int cx = roll(0, MAP_WIDTH - 20);
+    int cy = roll(0, MAP_HEIGHT - 20);
+    for (int i = 0; i < count; ++i)
+    {
+        NpcSpec spec;
+        spec.species = roll(0, species - 1);
+        spec.x = clustered ? cx + roll(0, 19) : roll(0, MAP_WIDTH - 1);
+        spec.y = clustered ? cy + roll(0, 19) : roll(0, MAP_HEIGHT - 1);
+        scn.npcs.push_back(spec);
+    }
+
+    scn.ticks = roll(1, 8);
+    scn.moves_per_battle = roll(1, 3);
+    scn.range = roll(0, 1) ? roll(0, 30) : roll(0, 3000) / 100.0;
+    return scn;
+}
+
+// Жадно удаляет NPC и тики, пока расхождение сохраняется
+static Scenario shrink(Scenario scn)
+{
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+
+        for (size_t i = scn.npcs.size(); i-- > 0; )
+        {
+            Scenario smaller = scn;
+            smaller.npcs.erase(smaller.npcs.begin() + i);
+            if (!check(smaller).empty())
+            {
+                scn = smaller;
+                changed = true;
+            }
+        }
+
+        while (scn.ticks > 1)
+        {
+            Scenario smaller = scn;
+            --smaller.ticks;
+            if (check(smaller).empty()) break;
+            scn = smaller;
+            changed = true;
+        }
+
+        while (scn.moves_per_battle > 1)
+        {
+            Scenario smaller = scn;
+            --smaller.moves_per_battle;
+            if (check(smaller).empty()) break;
+            scn = smaller;
+            changed = true;
+        }
+    }
+    return scn;
+}
+
+static void print_reproducer(const Scenario& scn)
+{
+    cout << "=== Минимальный сценарий ===" << endl;
+    cout << "seed " << scn.seed << ", ticks " << scn.ticks
+         << ", moves_per_battle " << scn.moves_per_battle
+         << ", range " << scn.range << endl;
+    cout << "--- species ---\n" << scn.rules;
+    cout << "--- npcs ---" << endl;
+    std::istringstream rules(scn.rules);
+    auto table = SpeciesTable::parse(rules);
+    for (size_t i = 0; i < scn.npcs.size(); ++i)
+        cout << table->name(scn.npcs[i].species) << " N" << i << " "
+             << scn.npcs[i].x << " " << scn.npcs[i].y << endl;
+    cout << "--- " << check(scn) << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned long scenarios = argc > 1 ? std::stoul(argv[1]) : 10000;
+    unsigned first_seed = argc > 2 ? static_cast<unsigned>(std::stoul(argv[2])) : 1;
+
+    string turnaround = check_turnaround();
+    if (!turnaround.empty())
+    {
+        cout << "Ошибка: " << turnaround << endl;
+        return 1;
+    }
+
+#ifdef RPG_OUT_OF_CORE
+    // Мир вне памяти медленнее, ему достается каждый сотый сценарий
+    for (unsigned long n = 0; n < std::max(1ul, scenarios / 100); ++n)
+    {
+        unsigned seed = first_seed + static_cast<unsigned>(n);
+        string report;
+        try
+        {
+            report = check_out_of_core(seed, generate(seed).rules);
+        }
+        catch (const std::exception& e)
+        {
+            report = string("исключение: ") + e.what();
+        }
+        if (!report.empty())
+        {
+            cout << "Мир вне памяти, сценарий " << seed << ": " << report << endl;
+            return 1;
+        }
+    }
+#endif
+
+    for (unsigned long n = 0; n < scenarios; ++n)
+    {
+        unsigned seed = first_seed + static_cast<unsigned>(n);
+        Scenario scn = generate(seed);
+        string report = check(scn);
+        if (!report.empty())
+        {
+            cout << "Расхождение в сценарии " << seed << ": " << report << endl;
+            print_reproducer(shrink(scn));
+            return 1;
+        }
+
+        if ((n + 1) % 100000 == 0)
+            cout << "Проверено сценариев: " << n + 1 << endl;
+    }
+
+    cout << "Все " << scenarios << " сценариев совпали" << endl;
+    return 0;
+}